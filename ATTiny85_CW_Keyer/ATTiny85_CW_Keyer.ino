@@ -56,14 +56,47 @@
 
 // Time after which callsign training is assumed complete
 #define TRAINTIMEOUT 10  // 10 Seconds
+#define TRAINCHARS   36  // Trainer statistics for 0-9 and A-Z
+#define TRAINQUICK   (YACKSECS(1) / 4)  // Start latency (in 4 beat units) below which a character counts as quick
+#define TRAINSLOW    (YACKSECS(1) / 2)  // Beats a character may take beyond its played length and still count as quick
+#define TRAINERRWGT   8  // Weight of one recent error against start latency when choosing characters
 #define PITCHREPEAT 10   // 10 e's will be played for pitch adjust
-#define FARNSREPEAT 10   // 10 a's will be played for Farnsworth
+#define FARNSREPEAT 10   // 10 a's will be played for Farnsworth and element timing
+
+// Beacon schedule. There is one slot per message; slot n plays message n + 1.
+// Each slot is kept in a user word: interval in seconds (bits 0-13) and repeats - 1 (bits 14-15)
+#define BCNSLOTS      4
+#define BCNMAXINT  9999  // Longest interval in seconds
+#define BCNMAXREP     4  // Most repeats of the message per transmission
+#define BCNUSER(n) (BCNSLOTS - (n))  // User word of slot n (message 4 uses word 1 as in older versions)
+
+// Some texts in Flash used by the application, Morse encoded at compile time (play with yackcode)
+YACKCW(txok, "R");
+YACKCW(vers, "V0.88");
+YACKCW(prgx, "#");  // # decodes to prosign SK with no intercharacter gap
+YACKCW(imok, "73");
+
+// Complete state of the keyer application: the YACK library context plus what the
+// application functions below need to remember between calls
+struct KEYER
+{
+  YACKCTX yack;   // Keyer library state
+  word lfsr;      // Random number generator state
+
+  // Beacon schedule
+  struct
+  {
+    word interval;  // Interval in seconds (0 = slot off)
+    byte repeat;    // Number of times the message is sent
+    uint32_t next;  // yacktime when the slot is due next
+  } bcn[BCNSLOTS];
 
-// Some texts in Flash used by the application
-const char txok[] PROGMEM = "R";
-const char vers[] PROGMEM = "V0.88";
-const char prgx[] PROGMEM = "#";  // # decodes to prosign SK with no intercharacter gap
-const char imok[] PROGMEM = "73";
+  // Callsign trainer statistics per character (0-9, A-Z)
+  byte trnlat[TRAINCHARS];  // Average start latency in units of 4 beats
+  byte trnerr[TRAINCHARS];  // Recent errors
+};
+
+KEYER keyer;
 
 /*! 
  @brief     Pitch change mode
@@ -73,66 +106,69 @@ const char imok[] PROGMEM = "73";
  
  Once 10 dots have been played at the same pitch, the mode terminates
  */
-void pitch(void)
+void pitch(YACKCTX *ctx)
 {
   word timer = PITCHREPEAT;
 
   while (timer)  // while not yet timed out
   {
     timer--;
-    yackchar('E');  // play an 'e'
+    yackchar(ctx, 'E');  // play an 'e'
 
-    if (yackctrlkey(TRUE))
+    if (yackctrlkey(ctx, TRUE))
     {
       return;
     }
 
     if (!(KEYINP & (1 << DITPIN)))  // if DIT was keyed
     {
-      yackpitch(DOWN);  // increase the pitch
+      yackpitch(ctx, DOWN);  // increase the pitch
       timer = PITCHREPEAT;
     }
 
     if (!(KEYINP & (1 << DAHPIN)))  // if DAH was keyed
     {
-      yackpitch(UP);  // lower the pitch
+      yackpitch(ctx, UP);  // lower the pitch
       timer = PITCHREPEAT;
     }
   }
 }
 
 /*! 
- @brief     Farnsworth change mode
+ @brief     Farnsworth and element timing change mode
+ 
+ This function implements the change mode for one of the timing parameters. In FARNSWORTH mode the
+ effective speed can be lowered (DIT) or raised (DAH) with the paddle keys. Raising it up to the
+ character speed switches Farnsworth off. In WEIGHTING, DAHRATIO, TXCOMP and LATCHWIN mode, DIT
+ decreases and DAH increases the respective setting.
  
- This function implements farnsworth pause change mode. Farnsworth pauses can be added or removed
- with the paddle keys.
+ @param mode FARNSWORTH, WEIGHTING, DAHRATIO, TXCOMP or LATCHWIN
  
  */
-void setfarns(void)
+void setparam(YACKCTX *ctx, byte mode)
 {
   byte timer = 0;
 
   while (timer++ != FARNSREPEAT)  // while not yet timed out
   {
-    if (yackctrlkey(TRUE))
+    if (yackctrlkey(ctx, TRUE))
     {
       return;
     }
 
-    yackplay(DIT);
-    yackdelay(IEGLEN);  // Inter Element gap
-    yackplay(DAH);
-    yackdelay(ICGLEN);  // Inter Character gap
-    yackfarns();        // Additional Farnsworth delay
+    yackplay(ctx, DIT);
+    yackplay(ctx, DAH);
+    yackdelay(ctx, ICGLEN - IEGLEN);  // Inter Character gap
+    yackfarns(ctx);                   // Additional Farnsworth delay
 
     if (!(KEYINP & (1 << DITPIN)))  // if DIT was keyed
     {
-      yackspeed(DOWN, FARNSWORTH);  // increase interword spacing
+      yackspeed(ctx, DOWN, mode);  // lower effective speed (more spacing) or setting
       timer = 0;
     }
     else if (!(KEYINP & (1 << DAHPIN)))  // if DAH was keyed
     {
-      yackspeed(UP, FARNSWORTH);  // decrease interword spacing
+      yackspeed(ctx, UP, mode);  // raise effective speed (less spacing) or setting
       timer = 0;
     }
   }
@@ -147,24 +183,54 @@ void setfarns(void)
  feedback shift register) in the Galois method which is good enough 
  for this specific application.
  
+ The upper byte of the register is scaled into the requested range by a
+ multiplication and a shift, which takes the same time for any n (unlike a
+ subtraction loop).
+ 
  @param n    a number between 2 and 255
  @return     a random number between 0 and n-1
  */
-word lfsr(byte n)
+word lfsr(KEYER *k, byte n)
 {
-  static word lfsr = 0xACE1;
-  byte random;
+  k->lfsr = (k->lfsr >> 1) ^ (-(k->lfsr & 1u) & 0xB400u);
 
-  lfsr = (lfsr >> 1) ^ (-(lfsr & 1u) & 0xB400u);
+  // Upper byte of word scaled to 0..n-1
+  return ((k->lfsr >> 8) * n) >> 8;
+}
 
-  random = lfsr >> 8;  // Byte = upper byte of word
+/*! 
+ @brief     Maps a trainer character to its statistics slot
+ 
+ @param c    A digit or upper case letter
+ @return     0-9 for digits, 10-35 for letters
+ */
+byte trainidx(char c)
+{
+  return (c <= '9') ? (c - '0') : (c - 'A' + 10);
+}
 
-  while (random >= n)
+/*! 
+ @brief     Picks a trainer character, preferring weak ones
+ 
+ Two random candidates are drawn from first .. first + n - 1. The one with the
+ higher start latency and error score is returned. This biases the trainer
+ towards the characters the operator is slowest on, at constant cost.
+ 
+ @param first    Statistics slot of the first character of the range
+ @param n        Number of characters in the range
+ @return         The statistics slot of the chosen character
+ */
+byte trainpick(KEYER *k, byte first, byte n)
+{
+  byte a = first + lfsr(k, n);
+  byte b = first + lfsr(k, n);
+
+  if ((k->trnlat[b] + TRAINERRWGT * k->trnerr[b]) > (k->trnlat[a] + TRAINERRWGT * k->trnerr[a]))
   {
-    random -= n;  // Cheap modulo :-)
+    a = b;
   }
 
-  return random;
+  return a;
 }
 
 /*! 
@@ -174,7 +240,7 @@ word lfsr(byte n)
  
  @param call a pointer to a buffer of sufficient size to store the callsign
  */
-void rndcall(char* call)
+void rndcall(KEYER *k, char* call)
 {
   byte i;
 
@@ -183,48 +249,55 @@ void rndcall(char* call)
   {
     if (i == 2)
     {
-      call[i] = lfsr(10) + '0';
+      call[i] = trainpick(k, 0, 10) + '0';
     }
     else
     {
-      call[i] = lfsr(26) + 'A';
+      call[i] = trainpick(k, 10, 26) - 10 + 'A';
     }
   }
 }
 
 /*! 
- @brief     Callsign trainer mode
+ @brief     Runs the callsign trainer until timeout or command key
  
- This implements callsign training. The keyer plays a random callsign and the 
- user repeats it on the paddle. If a mistake happens, the error prosign is
- sounded, the callsign sent again and the user attempts one more time.
+ @see cstrain
  */
-void cstrain(void)
+void cstrun(KEYER *k)
 {
+  YACKCTX *ctx = &k->yack;
   char call[5];  // A buffer to store the callsign
+  word len[5];   // Beats each character of the callsign took to play
   char c;        // The character returned by IAMBIC keyer
   byte i;        // Counter
   byte n;        // Playback counter
+  byte idx;      // Statistics slot of the expected character
+  byte quick;    // TRUE while all characters were started quickly and correct
   word timer;    // Timeout timer
+  word start;    // Beats until the operator started keying the character
+  word finish;   // Beats from the first element until the character was complete
+  uint32_t t;    // Start of playback
 
   while (1)  // Endless loop will exit throught RETURN statement only
   {
-    rndcall(call);  // Make up a callsign
+    rndcall(k, call);  // Make up a callsign
 
     i = 0;  // i counts the number of chracters correctly guessed
+    quick = TRUE;
 
     while (i < 5)
     {
       if (!i)  // If nothing guessed yet, play the callsign
       {
-        yackdelay(2 * IWGLEN);  // Give him some time to breathe b4 next callsign
+        yackdelay(ctx, 2 * IWGLEN);  // Give him some time to breathe b4 next callsign
 
         for (n = 0; n < 5; n++)
         {
-          yackchar(call[n]);
-          yackfarns();  // Add potential farnsworth delays
+          t = yacktime(ctx);
+          yackchar(ctx, call[n]);  // Includes potential Farnsworth spacing
+          len[n] = yacktime(ctx) - t;
 
-          if (yackctrlkey(TRUE))
+          if (yackctrlkey(ctx, TRUE))
           {
             return;  // Abort if requested..
           }
@@ -232,113 +305,339 @@ void cstrain(void)
       }
 
       timer = YACKSECS(TRAINTIMEOUT);
+      start = 0;
 
       do
       {
-        c = yackiambic(OFF);                             // Wait for a character
-        yackbeat();                                      // FSM heartbeat
+        c = yackiambic(ctx, OFF);                        // Wait for a character
+        yackbeat(ctx);                                   // FSM heartbeat
         timer--;                                         // Countdown
-      } while ((!c) && timer && !(yackctrlkey(FALSE)));  // Stop when character or timeout
 
-      if (timer == 0 || yackctrlkey(TRUE))  // If termination because of timeout
+        if (!start && yackbusy(ctx))                     // First element of the character?
+        {
+          start = YACKSECS(TRAINTIMEOUT) - timer;
+        }
+      } while ((!c) && timer && !(yackctrlkey(ctx, FALSE)));  // Stop when character or timeout
+
+      if (timer == 0 || yackctrlkey(ctx, TRUE))  // If termination because of timeout
       {
         return;  // then return
       }
 
+      // The character is complete about one dot into the gap, the played length
+      // includes the whole gap. Keying it as fast as it was played counts as quick.
+      finish = YACKSECS(TRAINTIMEOUT) - timer - start;
+
+      idx = trainidx(call[i]);
+      start = (start >> 2) > 255 ? 255 : (start >> 2);
+      k->trnlat[idx] = (3 * k->trnlat[idx] + start) >> 2;
+
+      if (start > TRAINQUICK || finish > len[i] + TRAINSLOW)
+      {
+        quick = FALSE;
+      }
+
       if (call[i] == c)  // Was it the right character?
       {
+        if (k->trnerr[idx])
+        {
+          k->trnerr[idx]--;
+        }
+
         i++;  // then increment counter
       }
       else
       {
-        yackerror();  // Send an error prosign
-        i = 0;        // And reset the counter
+        if (k->trnerr[idx] < 255)
+        {
+          k->trnerr[idx]++;
+        }
+
+        yackerror(ctx);                     // Send an error prosign
+        yacksetwpm(ctx, yackwpm(ctx) - 1);  // Slow down
+        quick = FALSE;
+        i = 0;                              // And reset the counter
       }
     }
 
-    yackchar('R');
+    if (quick)
+    {
+      yacksetwpm(ctx, yackwpm(ctx) + 1);  // Speed up
+    }
+
+    yackchar(ctx, 'R');
+  }
+}
+
+/*! 
+ @brief     Callsign trainer mode
+ 
+ This implements callsign training. The keyer plays a random callsign and the 
+ user repeats it on the paddle. If a mistake happens, the error prosign is
+ sounded, the callsign sent again and the user attempts one more time.
+ 
+ For every repeated character the beats until the operator starts keying it are
+ counted. The averaged start latency and the errors per character steer rndcall
+ towards weak characters. A callsign repeated without error, with every character
+ started quickly and finished in about the time the keyer took to play it, raises
+ the speed by 1 WPM. An error lowers it. The original speed is restored when
+ training ends, however it ends.
+ */
+void cstrain(KEYER *k)
+{
+  word wpm = yackwpm(&k->yack);  // Speed to restore on exit
+
+  cstrun(k);
+  yacksetwpm(&k->yack, wpm);
+}
+
+/*! 
+ @brief     Loads a beacon slot
+ 
+ Reads the slot from its user word and schedules the first transmission one
+ interval from now. Invalid content (e.g. erased EEPROM) switches the slot off.
+ 
+ @param n    The slot (0 .. BCNSLOTS - 1)
+ */
+void bcnload(KEYER *k, byte n)
+{
+  YACKCTX *ctx = &k->yack;
+  word w;
+
+  w = yackuser(ctx, READ, BCNUSER(n), 0);
+
+  k->bcn[n].interval = w & 0x3FFF;
+  k->bcn[n].repeat = (w >> 14) + 1;
+
+  if (k->bcn[n].interval > BCNMAXINT)
+  {
+    k->bcn[n].interval = 0;
   }
+
+  k->bcn[n].next = yacktime(ctx) + (uint32_t)k->bcn[n].interval * YACKSECS(1);
 }
 
 /*! 
  @brief     Beacon mode
  
- This routine can read a beacon transmission interval up to 
- 9999 seconds and store it in EEPROM (RECORD mode)
- In PLAY mode, when called in the YACKBEAT loop, it plays back
- message 2 in the programmed interval
+ This routine can read a beacon schedule and store it in EEPROM (RECORD mode).
+ The schedule is keyed as interval[/message[/repeats]], e.g. "600/2/3" sends
+ message 2 three times every 600 seconds. Message defaults to 4, repeats to 1.
+ Each message has its own slot; an interval of 0 (or none) switches it off.
  
- @param mode RECORD (read and store the beacon interval) or PLAY (beacon)
+ In PLAY mode, when called in the YACKBEAT loop, it plays back each message that
+ is due. Due times are kept as absolute beat counts from yacktime and advanced by
+ whole intervals, so time spent in playback, command mode etc. never shifts the
+ schedule. A transmission missed while busy is sent late (or skipped if a whole
+ interval has passed) but the following ones stay on the original grid.
+ 
+ @param mode RECORD (read and store the beacon schedule) or PLAY (beacon)
 
  @see main
  
 */
-void beacon(byte mode)
+void beacon(KEYER *k, byte mode)
 {
-  static word interval = 65000;  // A dummy value that can not be reached
-  static word timer;
+  YACKCTX *ctx = &k->yack;
+  word value[3] = {0, 4, 1};  // Interval, message, repeats
+  word timer;                 // Timeout timer
+  uint32_t period;            // Interval in beats
+  byte f = 0;                 // Field being keyed
+  byte n;                     // Slot
   char c;
 
-  if (interval == 65000)
-  {
-    interval = yackuser(READ, 1, 0);
-  }
-
   if (mode == RECORD)
   {
-    interval = 0;  // Reset previous settings
     timer = YACKSECS(DEFTIMEOUT);
 
-    yackchar('N');
+    yackchar(ctx, 'N');
 
     while (--timer)
     {
-      c = yackiambic(FALSE);
-      yackbeat();
+      c = yackiambic(ctx, FALSE);
+      yackbeat(ctx);
 
       if (c >= '0' && c <= '9')
       {
-        interval *= 10;
-        interval += c - '0';
+        if (value[f] < 1000)
+        {
+          value[f] *= 10;
+          value[f] += c - '0';
+        }
+        else
+        {
+          value[f] = 0xFFFF;  // Too many digits
+        }
+
+        timer = YACKSECS(DEFTIMEOUT);
+      }
+
+      if (c == '/' && f < 2)  // Next field
+      {
+        value[++f] = 0;
         timer = YACKSECS(DEFTIMEOUT);
       }
     }
 
-    if (interval >= 0 && interval <= 9999)
+    if (value[0] <= BCNMAXINT && value[1] >= 1 && value[1] <= BCNSLOTS && value[2] >= 1 && value[2] <= BCNMAXREP)
     {
-      yackuser(WRITE, 1, interval);  // Record interval
-      yacknumber(interval);          // Playback number
+      n = value[1] - 1;
+      yackuser(ctx, WRITE, BCNUSER(n), value[0] | ((value[2] - 1) << 14));  // Record slot
+      bcnload(k, n);
+      yacknumber(ctx, value[0]);  // Playback number
     }
     else
     {
-      yackerror();
+      yackerror(ctx);
     }
   }
 
-  if ((mode == PLAY) && interval)
+  if (mode == PLAY)
   {
+    for (n = 0; n < BCNSLOTS; n++)
+    {
+      if (!k->bcn[n].interval)
+      {
+        continue;
+      }
+
 #ifdef POWERSAVE
-    // If we execute this, the interval counter is positive which means we are waiting
-    // for a message playback. In this case we must not allow the CPU to enter sleep mode.
-    yackpower(FALSE);  // Inhibit sleep mode
+      // If we execute this, a slot is active which means we are waiting
+      // for a message playback. In this case we must not allow the CPU to enter sleep mode.
+      yackpower(ctx, FALSE);  // Inhibit sleep mode
 #endif
 
-    if (timer)
+      if ((int32_t)(yacktime(ctx) - k->bcn[n].next) >= 0)  // Due?
+      {
+        yackinhibit(ctx, OFF);  // End any greeting still playing
+
+        for (f = 0; f < k->bcn[n].repeat; f++)
+        {
+          yackmessage(ctx, PLAY, n + 1);  // Play the message
+        }
+
+        // Stay on the grid, skipping transmissions that are overdue by a whole interval
+        period = (uint32_t)k->bcn[n].interval * YACKSECS(1);
+
+        do
+        {
+          k->bcn[n].next += period;
+        } while ((int32_t)(yacktime(ctx) - k->bcn[n].next) >= 0);
+
+        return;  // One transmission per call
+      }
+    }
+  }
+}
+
+/*! 
+ @brief     Serial number entry
+ 
+ Reads the next contest serial number (sent by the _N macro code) from the paddle
+ and stores it. If no digits are keyed before the timeout, the current number is
+ played back unchanged.
+ 
+*/
+void serialnr(YACKCTX *ctx)
+{
+  word timer = YACKSECS(DEFTIMEOUT);
+  word value = 0;
+  byte digits = 0;
+  char c;
+
+  yackchar(ctx, '=');
+
+  while (--timer)
+  {
+    c = yackiambic(ctx, FALSE);
+    yackbeat(ctx);
+
+    if (c >= '0' && c <= '9' && value < 1000)
     {
-      timer--;  // Countdown until a second has expired
+      value *= 10;
+      value += c - '0';
+      digits++;
+      timer = YACKSECS(DEFTIMEOUT);
     }
-    else
+  }
+
+  if (digits)
+  {
+    yackserial(ctx, WRITE, value);
+  }
+
+  yacknumber(ctx, yackserial(ctx, READ, 0));  // Playback number
+}
+
+/*! 
+ @brief     Configuration profile selection
+ 
+ Reads a profile number from the paddle and loads it as the active configuration.
+ If S is keyed before the number, the active configuration is stored in that profile
+ instead. The command completes as soon as the number is keyed.
+ 
+*/
+void profile(YACKCTX *ctx)
+{
+  word timer = YACKSECS(DEFTIMEOUT);
+  byte func = READ;
+  char c;
+
+  yackchar(ctx, 'Y');
+
+  while (--timer)
+  {
+    c = yackiambic(ctx, FALSE);
+    yackbeat(ctx);
+
+    if (c == 'S')  // Store instead of load
     {
-      timer = YACKSECS(1);  // Reset timer
+      func = WRITE;
+      timer = YACKSECS(DEFTIMEOUT);
+    }
 
-      if ((--interval) == 0)  // Interval was > 0. Did decrement bring it to 0?
+    if (c >= '0' && c <= '9')
+    {
+      if (yackprofile(ctx, func, c - '0'))
+      {
+        yackchar(ctx, c);
+      }
+      else
       {
-        interval = yackuser(READ, 1, 0);  // Reset the interval timer
-        yackmessage(PLAY, 4);             // And play message 4
+        yackerror(ctx);
       }
+
+      return;
     }
   }
+
+  yackerror(ctx);
+}
+
+#ifdef TELEMETRY
+/*! 
+ @brief     Plays the telemetry counters
+ 
+ Sends the characters sent, decoded and not decodable, the TX duty cycle in percent
+ since power up and then the paddle-to-keydown latency histogram (0, 1, 2.. beats).
+ 
+*/
+void telemetry(YACKCTX *ctx)
+{
+  const struct YACKTLM *t = yacktelemetry(ctx);
+
+  yacknumber(ctx, t->sent);
+  yacknumber(ctx, t->decoded);
+  yacknumber(ctx, t->undecoded);
+  yacknumber(ctx, t->keydown * 100 / (yacktime(ctx) + 1));
+  yackchar(ctx, '=');
+
+  for (byte n = 0; n < TLMBINS; n++)
+  {
+    yacknumber(ctx, t->latency[n]);
+  }
 }
+#endif
 
 /*! 
  @brief     Command mode
@@ -347,110 +646,156 @@ void beacon(byte mode)
  and interpreted as commands.
  
 */
-void commandmode(void)
+void commandmode(KEYER *k)
 {
+  YACKCTX *ctx = &k->yack;
   char c;      // Character from Morse key
   word timer;  // Exit timer
 
-  yackinhibit(ON);  // Sidetone = on, Keyer = off
+  yackinhibit(ctx, ON);  // Sidetone = on, Keyer = off
 
-  yackchar('?');  // Play Greeting
+  yackchar(ctx, '?');  // Play Greeting
 
   timer = YACKSECS(DEFTIMEOUT);  // Time out after 10 seconds
 
-  while ((yackctrlkey(TRUE) == 0) && (timer-- > 0))
+  while ((yackctrlkey(ctx, TRUE) == 0) && (timer-- > 0))
   {
-    c = yackiambic(OFF);
+    c = yackiambic(ctx, OFF);
 
     if (c)
     {
       timer = YACKSECS(DEFTIMEOUT);  // Reset timeout if character read
     }
 
-    yackbeat();
+    yackbeat(ctx);
 
-    lfsr(255);  // Keep seeding the LFSR so we get different callsigns
+    lfsr(k, 255);  // Keep seeding the LFSR so we get different callsigns
 
-    if (!yackflag(CONFLOCK))  // No Configuration lock?
+    if (!yackflag(ctx, CONFLOCK))  // No Configuration lock?
     {
       switch (c)  // These are the lockable configuration commands
       {
         case 'R':  // Reset
-          yackreset(FLAGS);
+          yackreset(ctx, FLAGS);
           c = TRUE;
           break;
 
         case 'A':  // IAMBIC A
-          yackmode(IAMBICA);
+          yackmode(ctx, IAMBICA);
           c = TRUE;
           break;
 
         case 'B':  // IAMBIC B
-          yackmode(IAMBICB);
+          yackmode(ctx, IAMBICB);
           c = TRUE;
           break;
 
         case 'L':  // ULTIMATIC
-          yackmode(ULTIMATIC);
+          yackmode(ctx, ULTIMATIC);
           c = TRUE;
           break;
 
         case 'D':  // DAHPRIO
-          yackmode(DAHPRIO);
+          yackmode(ctx, DAHPRIO);
           c = TRUE;
           break;
 
         case 'X':  // Paddle swapping
-          yacktoggle(PDLSWAP);
+          yacktoggle(ctx, PDLSWAP);
           c = TRUE;
           break;
 
         case 'S':  // Sidetone toggle
-          yacktoggle(SIDETONE);
+          yacktoggle(ctx, SIDETONE);
           c = TRUE;
           break;
 
         case 'K':  // TX keying toggle
-          yacktoggle(TXKEY);
+          yacktoggle(ctx, TXKEY);
           c = TRUE;
           break;
 
         case 'Z':  // Farnsworth pause
-          setfarns();
+          setparam(ctx, FARNSWORTH);
+          c = TRUE;
+          break;
+
+        case 'H':  // Weighting
+          setparam(ctx, WEIGHTING);
+          c = TRUE;
+          break;
+
+        case 'J':  // Dah to dit ratio
+          setparam(ctx, DAHRATIO);
+          c = TRUE;
+          break;
+
+        case 'Q':  // TX keying compensation
+          setparam(ctx, TXCOMP);
+          c = TRUE;
+          break;
+
+        case '5':  // Paddle latch window
+          setparam(ctx, LATCHWIN);
+          c = TRUE;
+          break;
+
+        case 'O':  // Oscillator calibration
+          yackcalibrate(ctx);
+          c = TRUE;
+          break;
+
+        case '6':  // Autospace toggle
+          yacktoggle(ctx, AUTOSPACE);
+          c = TRUE;
+          break;
+
+        case '7':  // Straight key toggle
+          yackxtoggle(ctx, STRAIGHT);
           c = TRUE;
           break;
 
         case 'F':  // TX level inverter toggle
-          yacktoggle(TXINV);
+          yacktoggle(ctx, TXINV);
           c = TRUE;
           break;
 
         case '1':  // Record Macro 1
-          yackchar('1');
-          yackmessage(RECORD, 1);
+          yackchar(ctx, '1');
+          yackmessage(ctx, RECORD, 1);
           c = TRUE;
           break;
 
         case '2':  // Record Macro 2
-          yackchar('2');
-          yackmessage(RECORD, 2);
+          yackchar(ctx, '2');
+          yackmessage(ctx, RECORD, 2);
           c = TRUE;
           break;
 
         case '3':  // Record Macro 3
-          yackchar('3');
-          yackmessage(RECORD, 3);
+          yackchar(ctx, '3');
+          yackmessage(ctx, RECORD, 3);
           c = TRUE;
           break;
 
         case '4':  // Record Macro 4
-          yackchar('4');
-          yackmessage(RECORD, 4);
+          yackchar(ctx, '4');
+          yackmessage(ctx, RECORD, 4);
           c = TRUE;
           break;
 
         case 'N':  // Automatic Beacon
-          beacon(RECORD);
+          beacon(k, RECORD);
+          c = TRUE;
+          break;
+
+        case 'Y':  // Configuration profiles
+          profile(ctx);
+          c = TRUE;
+          break;
+
+        case '=':  // Contest serial number
+          serialnr(ctx);
           c = TRUE;
           break;
       }
@@ -459,95 +804,111 @@ void commandmode(void)
     switch (c)  // Commands that can be used anytime
     {
       case 'V':  // Version
-        yackstring(vers);
+        yackcode(ctx, vers);
         c = TRUE;
         break;
 
       case 'P':  // Pitch
-        pitch();
+        pitch(ctx);
         c = TRUE;
         break;
 
       case 'U':  // Tune
-        yackinhibit(OFF);
-        yacktune();
-        yackinhibit(ON);
+        yackinhibit(ctx, OFF);
+        yacktune(ctx);
+        yackinhibit(ctx, ON);
         c = TRUE;
         break;
 
       case 'C':  // Callsign training
-        cstrain();
+        cstrain(k);
         c = TRUE;
         break;
 
       case '0':  // Lock changes
-        yacktoggle(CONFLOCK);
+        yacktoggle(ctx, CONFLOCK);
         c = TRUE;
         break;
 
       case 'E':  // Playback Macro 1
-        yackinhibit(OFF);
-        yackmessage(PLAY, 1);
-        yackinhibit(ON);
+        yackinhibit(ctx, OFF);
+        yackmessage(ctx, PLAY, 1);
+        yackinhibit(ctx, ON);
         timer = YACKSECS(MACTIMEOUT);
         c = FALSE;
         break;
 
       case 'I':  // Playback Macro 2
-        yackinhibit(OFF);
-        yackmessage(PLAY, 2);
-        yackinhibit(ON);
+        yackinhibit(ctx, OFF);
+        yackmessage(ctx, PLAY, 2);
+        yackinhibit(ctx, ON);
         timer = YACKSECS(MACTIMEOUT);
         c = FALSE;
         break;
 
       case 'T':  // Playback Macro 3
-        yackinhibit(OFF);
-        yackmessage(PLAY, 3);
-        yackinhibit(ON);
+        yackinhibit(ctx, OFF);
+        yackmessage(ctx, PLAY, 3);
+        yackinhibit(ctx, ON);
         timer = YACKSECS(MACTIMEOUT);
         c = FALSE;
         break;
 
       case 'M':  // Playback Macro 4
-        yackinhibit(OFF);
-        yackmessage(PLAY, 4);
-        yackinhibit(ON);
+        yackinhibit(ctx, OFF);
+        yackmessage(ctx, PLAY, 4);
+        yackinhibit(ctx, ON);
         timer = YACKSECS(MACTIMEOUT);
         c = FALSE;
         break;
 
       case 'W':  // Query WPM
-        yacknumber(yackwpm());
+        yacknumber(ctx, yackwpm(ctx));
+        c = TRUE;
+        break;
+
+#ifdef TELEMETRY
+      case 'G':  // Query telemetry
+        telemetry(ctx);
         c = TRUE;
         break;
+#endif
     }
 
     if (c == TRUE)  // If c still contains a string, the command was not handled properly
     {
-      yacksave();             //Save any non-volatile changes to EEPROM
-      yackdelay(DAHLEN * 3);  //Eliminate runon txok on some commands
-      yackstring(txok);
+      yacksave(ctx);               //Save any non-volatile changes to EEPROM
+      yackdelay(ctx, DAHLEN * 3);  //Eliminate runon txok on some commands
+      yackcode(ctx, txok);
     }
     else if (c)
     {
-      yackerror();
+      yackerror(ctx);
     }
   }
 
-  yackstring(prgx);  // Sign off
-  yackinhibit(OFF);  // Back to normal mode
+  yackcode(ctx, prgx);  // Sign off
+  yackinhibit(ctx, OFF);  // Back to normal mode
 }
 
 void setup()
 {
+  YACKCTX *ctx = &keyer.yack;
+
   // Initialize YACK hardware
-  yackinit(FLAGS);
+  yackinit(ctx, FLAGS);
+
+  // Initialize the application state
+  keyer.lfsr = 0xACE1;
+
+  for (byte n = 0; n < BCNSLOTS; n++)
+  {
+    bcnload(&keyer, n);
+  }
 
-  // Side tone greeting to confirm the unit is alive and kicking
-  yackinhibit(ON);
-  yackstring(imok);
-  yackinhibit(OFF);
+  // Side tone greeting to confirm the unit is alive and kicking. It plays in the
+  // background so the paddles can be used right away.
+  yackqueue(ctx, imok);
 }
 
 /*! 
@@ -560,12 +921,25 @@ void setup()
 */
 void loop()
 {
-  if (yackctrlkey(TRUE))  // If command key pressed, go to command mode
+  KEYER *k = &keyer;
+  YACKCTX *ctx = &k->yack;
+
+  if (yackctrlkey(ctx, TRUE))  // If command key pressed, go to command mode
   {
-    commandmode();
+    commandmode(k);
   }
 
-  yackbeat();
-  beacon(PLAY);  // Play beacon if requested
-  yackiambic(OFF);
+  yackbeat(ctx);
+  beacon(k, PLAY);  // Play beacon if requested
+
+#ifdef SERIALPIN
+  char c = yackiambic(ctx, ON);  // Word spaces are wanted here
+
+  if (c)
+  {
+    yacklog(ctx, c);  // Stream what was sent to the PC
+  }
+#else
+  yackiambic(ctx, OFF);
+#endif
 }
@@ -47,36 +47,106 @@
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 #include <util/delay.h>
+#include <util/atomic.h>
+#include <string.h>
 #include <stdint.h>
 #include "yack.h"
 
 // Forward declaration of private functions
-static void key(byte mode);
+static void key(YACKCTX *ctx, byte mode);
 static char morsechar(byte buffer);
-static void keylatch(void);
+static void keylatch(YACKCTX *ctx, byte pins);
+static void yackpass(YACKCTX *ctx);
+static void passkey(YACKCTX *ctx, byte mode);
+static void yackeewrite(void *dst, const void *src, byte n);
+static void yackeebyte(byte *dst, byte val);
+static void yackeeword(word *dst, word val);
+static void yackeeflush(void);
+static byte yackeeread(const void *src);
+static void yackwait(YACKCTX *ctx, word n);
+static void yacksymbol(YACKCTX *ctx, byte code);
+static void yackrun(YACKCTX *ctx, const word *run, byte n);
+static void yackspace(YACKCTX *ctx);
+static void yackgetcfg(YACKCTX *ctx, struct YACKCFG *cfg);
+static byte yacksetcfg(YACKCTX *ctx, const struct YACKCFG *cfg);
+static void yackvalidate(YACKCTX *ctx);
+static void yacknext(YACKCTX *ctx);
+static void yacktiming(YACKCTX *ctx);
+#ifdef SPEEDPOT
+static void yackpot(YACKCTX *ctx);
+#endif
+#ifdef TELEMETRY
+static void yackcount(word *n);
+#endif
+
+// Heartbeat. These belong to Timer1 and are therefore shared by all keyer contexts
+static volatile uint32_t ticks;  // Free running beat counter
+static volatile byte beatflag;   // Set by the timer interrupt on every beat
+static byte beatfrac;            // Accumulated fractional Timer1 counts (1/256)
+#ifdef SERIALPIN
+static volatile byte serbuf[SERBUF];  // Characters waiting for the serial output
+static volatile byte serhead;         // Next free position in serbuf
+static volatile byte sertail;         // Next character to send from serbuf
+static word serframe;                 // Bits of the current frame not sent yet, LSB first
+#endif
 
-// Enumerations
-enum FSMSTATE
+// Pin change interrupt. Like Timer1 it serves one keyer context, the one initialized last
+static YACKCTX *passctx;         // Context keyed by the straight key pass-through
+static volatile byte passarm;    // Set while the pass-through may key (see yackpass)
+#ifdef POWERSAVE
+static volatile byte wakepins;   // Paddle contacts seen closed by the pin change interrupt
+static byte woke;                // Set for the beat in which a paddle woke us up
+#endif
+
+// EEPROM write queue, retired by the EEPROM ready interrupt
+static volatile struct
 {
-  IDLE,   //!< Not keyed, waiting for paddle
-  KEYED,  //!< Keyed, waiting for duration of current element
-  IEG     //!< In Inter-Element-Gap
-};
+  word addr;                     // EEPROM address
+  byte data;                     // Value to write there
+} eeq[EEQSIZE];
+static volatile byte eeqhead;    // Next free entry in eeq
+static volatile byte eeqtail;    // Next entry to write
+
+#if (EEQSIZE & (EEQSIZE - 1))
+  #error "EEQSIZE must be a power of 2"
+#endif
+
+// Timer1 counts (at clk/64) per beat in 1/256 counts, split into whole and fractional part
+#define T1CNT256  (F_CPU / 64 * YACKBEAT * 256 / 1000)
+#define T1WHOLE   (T1CNT256 >> 8)
+#define T1FRAC    (T1CNT256 & 0xFF)
+
+#if (T1WHOLE > 255)
+  #error "Heartbeat does not fit Timer1 at this clock rate, adapt the prescaler"
+#endif
 
-// Module local definitions
-static byte yackflags;     // Permanent (stored) status of module flags
-static byte volflags = 0;  // Temporary working flags (volatile)
-static word ctcvalue;      // Pitch
-static word wpmcnt;        // Speed
-static byte wpm;           // Real wpm
-static byte farnsworth;    // Additional Farnsworth pause
+#ifdef PTTPIN
+  #if (YACKMS(PTTHANG) < 1)
+    #error "PTT hang time must be at least one beat"
+  #endif
+  #if (defined(SPEEDPOT) && PTTPIN == 5 && POTMUX == 0)
+    #error "PTT and speed pot can not share PB5"
+  #endif
+#endif
+
+#ifdef SERIALPIN
+  #if (defined(PTTPIN) && PTTPIN == SERIALPIN)
+    #error "PTT and serial output can not share a pin"
+  #endif
+  #if (defined(SPEEDPOT) && SERIALPIN == 5 && POTMUX == 0)
+    #error "Serial output and speed pot can not share PB5"
+  #endif
+  #if (SERBUF & (SERBUF - 1))
+    #error "SERBUF must be a power of 2"
+  #endif
+#endif
 
 // EEPROM Data
 byte magic EEMEM = MAGPAT;                           // Needs to contain 'A5' if mem is valid
 byte flagstor EEMEM = (IAMBICA | TXKEY | SIDETONE);  // Defaults
 word ctcstor EEMEM = DEFCTC;                         // Pitch = 700Hz
 byte wpmstor EEMEM = DEFWPM;                         // 15 WPM
-byte fwstor EEMEM = 0;                               // No farnsworth pause
+byte fwstor EEMEM = 0;                               // No farnsworth spacing
 word user1 EEMEM = 0;                                // User storage
 word user2 EEMEM = 0;                                // User storage
 
@@ -85,88 +155,47 @@ char eebuffer2[100] EEMEM = "message 2";
 char eebuffer3[100] EEMEM = "message 3";
 char eebuffer4[100] EEMEM = "message 4";
 
+byte wgtstor EEMEM = DEFWEIGHT;                      // Standard weighting
+byte ratstor EEMEM = DEFRATIO;                       // 3:1 dah ratio
+byte compstor EEMEM = DEFCOMP;                       // No TX compensation
+word user3 EEMEM = 0;                                // User storage
+word user4 EEMEM = 0;                                // User storage
+byte calstor EEMEM = 0xFF;                           // OSCCAL (0xFF = factory calibration)
+word serstor EEMEM = 1;                              // Next contest serial number
+byte latchstor[2] EEMEM = {DEFLATCHA, DEFLATCHB};    // Latch windows for IAMBIC A and B
+struct YACKCFG cfgstor[2] EEMEM;                     // Active configuration (two copies)
+byte cfgsel EEMEM = 0xFF;                            // Copy in use (0xFF = none, use the settings above)
+struct YACKCFG profstor[PROFILES] EEMEM;             // Configuration profiles (empty)
+byte xflagstor EEMEM = 0;                            // Extended flags
+
 // Flash data
 
-//! Morse code table in Flash
-//! Encoding: Each byte is read from the left. 0 stands for a dot, 1
-//! stands for a dash. After each played element the content is shifted
-//! left. Playback stops when the leftmost bit contains a "1" and the rest
-//! of the bits are all zero.
-//!
-//! Example: A = .-
-//! Encoding: 01100000
-//!           .-
-//!             | This is the stop marker (1 with all trailing zeros)
-const byte morse[] PROGMEM =
+//! Length of a dot in 1/16 beats for every speed from MINWPM to MAXWPM.
+//! Saves a runtime division each time the speed changes.
+#define DOT16(n) ((16UL * 1200 / YACKBEAT + n / 2) / n)
+
+const word dottab[MAXWPM - MINWPM + 1] PROGMEM =
 {
-  0b11111100,  // 0
-  0b01111100,  // 1
-  0b00111100,  // 2
-  0b00011100,  // 3
-  0b00001100,  // 4
-  0b00000100,  // 5
-  0b10000100,  // 6
-  0b11000100,  // 7
-  0b11100100,  // 8
-  0b11110100,  // 9
-  0b01100000,  // A
-  0b10001000,  // B
-  0b10101000,  // C
-  0b10010000,  // D
-  0b01000000,  // E
-  0b00101000,  // F
-  0b11010000,  // G
-  0b00001000,  // H
-  0b00100000,  // I
-  0b01111000,  // J
-  0b10110000,  // K
-  0b01001000,  // L
-  0b11100000,  // M
-  0b10100000,  // N
-  0b11110000,  // O
-  0b01101000,  // P
-  0b11011000,  // Q
-  0b01010000,  // R
-  0b00010000,  // S
-  0b11000000,  // T
-  0b00110000,  // U
-  0b00011000,  // V
-  0b01110000,  // W
-  0b10011000,  // X
-  0b10111000,  // Y
-  0b11001000,  // Z
-  0b00110010,  // ?
-  0b01010110,  // .
-  0b10010100,  // /
-  0b11101000,  // ! (American Morse version, commonly used in ham circles)
-  0b11001110,  // ,
-  0b11100010,  // :
-  0b10101010,  // ;
-  0b01001010,  // "
-  0b00010011,  // $
-  0b01111010,  // ' (Apostrophe)
-  0b10110100,  // ( or [ (also prosign KN)
-  0b10110110,  // ) or ]
-  0b10000110,  // - (Hyphen or single dash)
-  0b01101010,  // @
-  0b00110110,  // _ (Underline)
-  0b01010010,  // Paragaraph break symbol
-  0b10001100,  // = and BT
-  0b00010110,  // SK
-  0b01010100,  // + and AR
-  0b10001011,  // BK
-  0b01000100,  // AS
-  0b10101100,  // KA (also ! in alternate Continental Morse)
-  0b00010100,  // VE
-  0b01011000   // AA
+  DOT16(5),  DOT16(6),  DOT16(7),  DOT16(8),  DOT16(9),
+  DOT16(10), DOT16(11), DOT16(12), DOT16(13), DOT16(14),
+  DOT16(15), DOT16(16), DOT16(17), DOT16(18), DOT16(19),
+  DOT16(20), DOT16(21), DOT16(22), DOT16(23), DOT16(24),
+  DOT16(25), DOT16(26), DOT16(27), DOT16(28), DOT16(29),
+  DOT16(30), DOT16(31), DOT16(32), DOT16(33), DOT16(34),
+  DOT16(35), DOT16(36), DOT16(37), DOT16(38), DOT16(39),
+  DOT16(40), DOT16(41), DOT16(42), DOT16(43), DOT16(44),
+  DOT16(45), DOT16(46), DOT16(47), DOT16(48), DOT16(49),
+  DOT16(50)
 };
 
-// The special characters at the end of the above table can not be decoded
-// without a small table to define their content. # stands for SK, $ for AR
+//! Morse code table in Flash (see MORSECODES in yack.h for the encoding)
+const byte morse[] PROGMEM =
+{
+  MORSECODES
+};
 
-// To add new characters, add them in the code table above at the end and below
-// Do not forget to increase the legth of the array..
-const char spechar[24] PROGMEM = "?./!,:;~$^()-@_|=#+*%&<>";
+//! Special characters matching the end of the above table
+const char spechar[] PROGMEM = SPECHARS;
 
 // Define register bit for Timer0 tone output. Eiher PB0 or PB1 on ATTiny85
 #if (STPIN == 0)
@@ -177,6 +206,14 @@ const char spechar[24] PROGMEM = "?./!,:;~$^()-@_|=#+*%&<>";
   #error "Only PB0 and PB1 supported on ATTiny85!
 #endif
 
+// If the TX line is OC1A (PB1), its edges are made by the Timer1 compare unit. key() only
+// selects whether the next compare match (the next beat) sets or clears the pin.
+#if (OUTPIN == 1)
+  #define TXOC1A
+  #define OC1ASET ((1 << COM1A1) | (1 << COM1A0))  // Set OC1A on compare match
+  #define OC1ACLR (1 << COM1A1)                    // Clear OC1A on compare match
+#endif
+
 
 // Functions
 
@@ -191,17 +228,23 @@ const char spechar[24] PROGMEM = "?./!,:;~$^()-@_|=#+*%&<>";
  stored in the .h file. It sets the dirty flag and calls the save routine
  to write the data into EEPROM immediately.
 */
-void yackreset(byte flags)
+void yackreset(YACKCTX *ctx, byte flags)
 {
-  ctcvalue = DEFCTC;                    // Initialize to 800 Hz
-  wpm = DEFWPM;                         // Init to default speed
-  wpmcnt = (1200 / YACKBEAT) / DEFWPM;  // default speed
-  farnsworth = 0;                       // No Farnsworth gap
-  yackflags = flags;
-  volflags |= DIRTYFLAG;
+  ctx->ctcvalue = DEFCTC;               // Initialize to 800 Hz
+  ctx->wpm = DEFWPM;                    // Init to default speed
+  ctx->farnsworth = 0;                  // No Farnsworth gap
+  ctx->weight = DEFWEIGHT;              // Standard weighting
+  ctx->dahratio = DEFRATIO;             // 3:1
+  ctx->txcomp = DEFCOMP;                // No compensation
+  ctx->latchwin[0] = DEFLATCHA;         // Latch in gap only
+  ctx->latchwin[1] = DEFLATCHB;         // Latch during element
+  ctx->yackflags = flags;
+  ctx->xflags = 0;
+  yacktiming(ctx);
+  ctx->volflags |= DIRTYFLAG;
 
   // Store them in EEPROM
-  yacksave();
+  yacksave(ctx);
 }
 
 
@@ -211,15 +254,52 @@ void yackreset(byte flags)
  This function initializes the keyer hardware according to configurations in the .h file.
  Then it attempts to read saved configuration settings from EEPROM. If not possible, it
  will reset all values to their defaults.
- This function must be called once before the remaining fuctions can be used.
+ This function must be called once for each keyer context before the remaining fuctions
+ can be used with it.
+ 
+ @param ctx     The keyer context to initialize
+ @param flags   Default yackflags used if EEPROM content is not valid
 */
-void yackinit(byte flags)
+void yackinit(YACKCTX *ctx, byte flags)
 {
   byte magval;
 
+  // Start from a clean keyer state
+  ctx->volflags = 0;
+  ctx->xflags = 0;
+  ctx->keyed = 0;
+  ctx->fsms = IDLE;
+  ctx->timer = 0;
+  ctx->lastsymbol = 0;
+  ctx->buffer = 0;
+  ctx->bcntr = 0;
+  ctx->iwgflag = 0;
+  ctx->ultimem = 0;
+  ctx->qtext = NULL;
+#ifdef SPEEDPOT
+  ctx->potfilt = 0;
+  ctx->potwpm = MINWPM;  // Where the filter starts
+#endif
+#ifdef POWERSAVE
+  ctx->shdntimer = 0;
+#endif
+#ifdef PTTPIN
+  ctx->ptttimer = 0;
+#endif
+#ifdef TELEMETRY
+  memset(&ctx->tlm, 0, sizeof(ctx->tlm));
+#endif
+
   // Configure DDR. Make OUT and ST output ports
   SETBIT(OUTDDR, OUTPIN);
   SETBIT(STDDR, STPIN);
+#ifdef PTTPIN
+  SETBIT(PTTDDR, PTTPIN);
+#endif
+#ifdef SERIALPIN
+  SETBIT(SERPORT, SERIALPIN);  // Idle level before the pin becomes an output
+  SETBIT(SERDDR, SERIALPIN);
+#endif
 
   // Configure internal pullups for all inputs
   if (DITPULLUP)
@@ -241,49 +321,133 @@ void yackinit(byte flags)
   // Is memory valid
   if (magval == MAGPAT)
   {
-    ctcvalue = eeprom_read_word(&ctcstor);    // Retrieve last ctc setting
-    wpm = eeprom_read_byte(&wpmstor);         // Retrieve last wpm setting
-    wpmcnt = (1200 / YACKBEAT) / wpm;         // Calculate speed
-    farnsworth = eeprom_read_byte(&fwstor);   // Retrieve last wpm setting
-    yackflags = eeprom_read_byte(&flagstor);  // Retrieve last flags
+    struct YACKCFG cfg;
+    byte found = FALSE;
+
+    // All settings arrive in one block read. Should the copy in use be damaged, the
+    // other one holds the previous configuration.
+    magval = eeprom_read_byte(&cfgsel);            // Configuration copy in use
+
+    if (magval < 2)
+    {
+      eeprom_read_block(&cfg, &cfgstor[magval], sizeof(cfg));
+      found = yacksetcfg(ctx, &cfg);
+
+      if (!found)
+      {
+        eeprom_read_block(&cfg, &cfgstor[!magval], sizeof(cfg));
+        found = yacksetcfg(ctx, &cfg);
+      }
+    }
+
+    // Settings saved by older versions only exist one by one
+    if (!found)
+    {
+      ctx->yackflags = eeprom_read_byte(&flagstor);  // Retrieve last flags
+      ctx->ctcvalue = eeprom_read_word(&ctcstor);    // Retrieve last ctc setting
+      ctx->wpm = eeprom_read_byte(&wpmstor);         // Retrieve last wpm setting
+      ctx->farnsworth = eeprom_read_byte(&fwstor);   // Retrieve last Farnsworth setting
+      ctx->weight = eeprom_read_byte(&wgtstor);      // Retrieve last weighting
+      ctx->dahratio = eeprom_read_byte(&ratstor);    // Retrieve last dah ratio
+      ctx->txcomp = eeprom_read_byte(&compstor);     // Retrieve last compensation
+      ctx->latchwin[0] = eeprom_read_byte(&latchstor[0]);  // Retrieve last latch windows
+      ctx->latchwin[1] = eeprom_read_byte(&latchstor[1]);
+    }
+
+    ctx->xflags = eeprom_read_byte(&xflagstor);    // Retrieve extended flags
+    magval = eeprom_read_byte(&calstor);           // Retrieve oscillator calibration
+
+    if (magval != 0xFF)
+    {
+      OSCCAL = magval;
+    }
+
+    yackvalidate(ctx);  // Settings written by older versions may be missing
+    yacktiming(ctx);    // Precompute element durations and gaps
   }
   else
   {
-    yackreset(flags);
+    yackreset(ctx, flags);
   }
 
-  yackinhibit(OFF);
+  yackinhibit(ctx, OFF);
+
+#ifdef TXOC1A
+  GTCCR |= (1 << FOC1A);  // Force the TX line to its idle level now, not at the first beat
+#endif
 
 #ifdef POWERSAVE
   PCMSK |= PWRWAKE;      // Define which keys wake us up
-  GIMSK |= (1 << PCIE);  // Enable pin change interrupt
 #endif
 
+  // Paddle contacts also drive the straight key pass-through
+  passarm = 0;
+  passctx = ctx;
+  PCMSK |= (1 << DITPIN) | (1 << DAHPIN);
+  GIMSK |= (1 << PCIE);  // Enable pin change interrupt
+
   // Initialize Timer1 to serve as the system heartbeat
   // CK runs at 1MHz. Prescaling by 64 makes that 15625 Hz (0.064 ms).
-  // Counting 78 cycles of that generates an overflow every 5ms
-  // 78 * 0.064ms = 4.992ms
+  // A 5ms beat takes 78.125 of these counts. The timer interrupt therefore alternates
+  // between 78 and 79 counts per cycle (OCR1C + 1) so that the mean is exact.
 
-  OCR1C = 78;                         // 77 counts per cycle
+  OCR1C = T1WHOLE - 1;                // 78 counts per cycle
   TCCR1 |= (1 << CTC1) | 0b00000111;  // Clear Timer on match, prescale ck by 64
   OCR1A = 1;                          // CTC mode does not create an overflow so we use OCR1A
+  TIMSK |= (1 << OCIE1A);             // Count beats in the background (see yacktime)
+  sei();
+
+#ifdef SPEEDPOT
+  // ADC for the speed pot. VCC reference, 8 bit left adjusted result, clk/8 = 125kHz ADC clock.
+  // The first conversion is started here and then restarted once per beat by yackpot.
+  DIDR0 |= (1 << POTDIDR);
+  ADMUX = (1 << ADLAR) | POTMUX;
+  ADCSRA = (1 << ADEN) | (1 << ADSC) | (1 << ADPS1) | (1 << ADPS0);
+#endif
 }
 
 
-#ifdef POWERSAVE
 /*! 
- @brief     A dummy pin change interrupt
+ @brief     Pin change interrupt
+ 
+ This function is called whenever there is a level change on one of the contacts we are monitoring
+ (dit, dah and, with POWERSAVE, the command key).
+ 
+ In sleep mode it collects the paddle contacts that were closed, so a dit that is already released again
+ by the time the CPU is up still gets sent.
  
- This function is called whenever the system is in sleep mode and there is a level change on one of the contacts 
- we are monitoring (dit, dah and the command key). As all handling is already taken care of by polling in the main 
- routines, there is nothing we need to do here.
+ In straight key mode it keys right away: keydown follows the key within microseconds instead of waiting
+ for the next beat. Everything else is taken care of by polling in the main routines.
  */
 ISR(PCINT0_vect)
 {
-  // Nothing to do here. All we want is to wake up..
+  byte mode = (~KEYINP & ((1 << DITPIN) | (1 << DAHPIN))) ? DOWN : UP;
+
+#ifdef POWERSAVE
+  wakepins |= ~KEYINP & ((1 << DITPIN) | (1 << DAHPIN));
+#endif
+
+  if (!passarm || (mode == DOWN) == (passctx->keyed != 0))
+  {
+    return;
+  }
+
+#ifdef PTTPIN
+  // The PTT lead time can not be waited for in here. The next beat keys instead.
+  if (mode == DOWN && (passctx->volflags & TXKEY) && !passctx->ptttimer)
+  {
+    return;
+  }
+#endif
+
+  passkey(passctx, mode);
+  passarm = 1;
 }
 
 
+#ifdef POWERSAVE
+
+
 /*! 
  @brief     Manages the power saving mode
  
@@ -297,35 +461,64 @@ ISR(PCINT0_vect)
  @param n   TRUE: OK to sleep, FALSE: Can not sleep now
  
 */
-void yackpower(byte n)
+void yackpower(YACKCTX *ctx, byte n)
 {
-  static uint32_t shdntimer = 0;
+  woke = FALSE;
 
   // True = we could go to sleep
   if (n)
   {
-    if (shdntimer++ == YACKSECS(PSTIME))
+    if (ctx->shdntimer++ == YACKSECS(PSTIME))
     {
       // So we do not go to sleep right after waking up..
-      shdntimer = 0;
+      ctx->shdntimer = 0;
+
+      // The EEPROM ready interrupt can not wake us up, so leave no writes pending
+      yackeeflush();
+
+#ifdef SPEEDPOT
+      // The ADC keeps drawing current in power down unless disabled. This also ends
+      // a conversion still running.
+      ADCSRA &= ~(1 << ADEN);
+#endif
 
       set_sleep_mode(SLEEP_MODE_PWR_DOWN);
 
+      // A paddle edge from here on must not get lost before we sleep. The interrupt it
+      // raises stays pending until after sleep_cpu and wakes us up at once. The BOD
+      // disable is timed and must not be interrupted either.
+      cli();
+      wakepins = 0;
       sleep_enable();
       sleep_bod_disable();
       sei();
       sleep_cpu();
       sleep_disable();
-      cli();
 
-      // There is no technical reason to CLI here but it avoids hitting the ISR every time
-      // the paddles are touched. If the remaining code needs the interrupts this is OK to remove.
+      // Interrupts stay enabled as the heartbeat depends on them. The pin change ISR is
+      // therefore also hit whenever the paddles are touched, which costs next to nothing.
+
+      // The paddle that woke us is the first element. Timer1 stood still during sleep,
+      // so start a fresh beat right now: yackiambic keys the element on return and it
+      // gets its full length. The compare value is already passed, no beat is counted.
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+      {
+        TCNT1 = OCR1A + 1;
+        beatflag = 0;
+        keylatch(ctx, wakepins);
+        woke = (wakepins != 0);
+      }
+
+#ifdef SPEEDPOT
+      // Back on with a fresh conversion for yackpot
+      ADCSRA |= (1 << ADEN) | (1 << ADSC);
+#endif
     }
   }
   // Passed parameter is FALSE
   else
   {
-    shdntimer = 0;
+    ctx->shdntimer = 0;
   }
 }
 #endif
@@ -337,260 +530,1046 @@ void yackpower(byte n)
  To save EEPROM write cycles, writing only happens when the flag DIRTYFLAG is set.
  After writing the flag is cleared
  
+ The settings are written as one record into the copy that is not in use. Only then
+ the selector byte is switched to it, so a power loss during the save leaves the
+ previous configuration intact. The writes are queued in this order and carried out
+ in the background.
+ 
  @callergraph
  
  */
-void yacksave(void)
+void yacksave(YACKCTX *ctx)
 {
+  struct YACKCFG cfg;
+  byte sel;
+
   // Dirty flag set?  
-  if (volflags & DIRTYFLAG)
+  if (ctx->volflags & DIRTYFLAG)
   {
-    eeprom_write_byte(&magic, MAGPAT);
-    eeprom_write_word(&ctcstor, ctcvalue);
-    eeprom_write_byte(&wpmstor, wpm);
-    eeprom_write_byte(&flagstor, yackflags);
-    eeprom_write_byte(&fwstor, farnsworth);
+    // Write the copy not in use, then switch over with a single byte write
+    yackgetcfg(ctx, &cfg);
+    yackeeflush();
+    sel = (eeprom_read_byte(&cfgsel) == 0);
+    yackeewrite(&cfgstor[sel], &cfg, sizeof(cfg));
+    yackeebyte(&cfgsel, sel);
+
+    yackeebyte(&magic, MAGPAT);
+    yackeebyte(&calstor, OSCCAL);
+    yackeebyte(&xflagstor, ctx->xflags);
 
     // Clear the dirty flag
-    volflags &= ~DIRTYFLAG;
+    ctx->volflags &= ~DIRTYFLAG;
   }
 }
 
 
 /*! 
- @brief     Inhibits keying during command phases
+ @brief     EEPROM ready interrupt
  
- This function is used to inhibit and re-enable TX keying (if configured) and enforce the internal 
- sidetone oscillator to be active so that the user can communicate with the keyer.
- 
- @param mode   ON inhibits keying, OFF re-enables keying 
+ Retires the write queue, one byte per interrupt. Bytes that already hold the queued
+ value are skipped without a write, which saves both time and write cycles. Once the
+ queue is empty the interrupt disables itself.
  
  */
-void yackinhibit(byte mode)
+ISR(EE_RDY_vect)
 {
-  if (mode)
-  {
-    volflags &= ~(TXKEY | SIDETONE);
-    volflags |= SIDETONE;
-  }
-  else
+  byte i = eeqtail;
+
+  while (i != eeqhead)
   {
-    volflags &= ~(TXKEY | SIDETONE);
-    volflags |= (yackflags & (TXKEY | SIDETONE));
+    // Read the current content
+    EEAR = eeq[i].addr;
+    EECR |= (1 << EERE);
+
+    if (EEDR != eeq[i].data)
+    {
+      EEDR = eeq[i].data;
+      eeqtail = (i + 1) & (EEQSIZE - 1);
+
+      // Erase and write. EEPE must follow EEMPE within 4 cycles.
+      EECR = (1 << EERIE) | (1 << EEMPE);
+      EECR |= (1 << EEPE);
 
-    key(UP);
+      return;
+    }
+
+    i = (i + 1) & (EEQSIZE - 1);
+    eeqtail = i;
   }
+
+  EECR &= ~(1 << EERIE);
 }
 
 
 /*! 
- @brief     Saves user defined settings
+ @brief     Queues a block of data for writing to EEPROM
  
- The routine using this library is given the opportunity to save up to two 16 bit sized
- values in EEPROM. In case of the sample main function this is used to store the beacon interval 
- timer value. The routine is not otherwise used by the library.
+ Returns as soon as the data is queued. Only when the queue is full, this waits for the
+ EEPROM ready interrupt to make room.
  
- @param func    States if the data is retrieved (READ) or written (WRITE) to EEPROM
- @param nr      1 or 2 (Number of user storage to access)
- @param content The 16 bit word to write. Not used in read mode.
- @return        The content of the retrieved value in read mode.
+ This is a private function.
+ 
+ @param dst     EEPROM address to write to
+ @param src     Data in RAM
+ @param n       Number of bytes
  
  */
-word yackuser(byte func, byte nr, word content)
+static void yackeewrite(void *dst, const void *src, byte n)
 {
-  if (func == READ)
-  {
-    if (nr == 1)
-    {
-      return (eeprom_read_word(&user1));
-    }
-    else if (nr == 2)
-    {
-      return (eeprom_read_word(&user2));
-    }
-  }
+  word addr = (word)dst;
+  const byte *p = (const byte *)src;
+  byte next;
 
-  if (func == WRITE)
+  while (n--)
   {
-    if (nr == 1)
-    {
-      eeprom_write_word(&user1, content);
-    }
-    else if (nr == 2)
+    next = (eeqhead + 1) & (EEQSIZE - 1);
+
+    while (next == eeqtail)
     {
-      eeprom_write_word(&user2, content);
+      // Queue full, wait for the interrupt to retire a byte
+      ;
     }
-  }
 
-  return (FALSE);
+    eeq[eeqhead].addr = addr++;
+    eeq[eeqhead].data = *p++;
+    eeqhead = next;
+
+    EECR |= (1 << EERIE);  // Start (or keep) the interrupt going
+  }
 }
 
 
 /*! 
- @brief     Retrieves the current WPM speed
+ @brief     Queues a byte for writing to EEPROM
  
- This function delivers the current WPM speed. 
+ This is a private function.
+ 
+ */
+static void yackeebyte(byte *dst, byte val)
+{
+  yackeewrite(dst, &val, sizeof(val));
+}
 
- @return        Current speed in WPM
+
+/*! 
+ @brief     Queues a word for writing to EEPROM
+ 
+ This is a private function.
  
  */
-word yackwpm(void)
+static void yackeeword(word *dst, word val)
 {
-  return wpm;
+  yackeewrite(dst, &val, sizeof(val));
 }
 
 
 /*! 
- @brief     Increases or decreases the current WPM speed
+ @brief     Waits until all queued EEPROM writes are done
  
- The amount of increase or decrease is in amounts of wpmcnt. Those are close to real
- WPM in a 10ms heartbeat but can significantly differ at higher heartbeat speeds.
+ Must precede any EEPROM read that could hit a queued byte. It also keeps the interrupt
+ from moving EEAR while a read is in progress.
  
- @param dir     UP (faster) or DOWN (slower)
+ This is a private function.
  
  */
-void yackspeed(byte dir, byte mode)
+static void yackeeflush(void)
 {
-  if (mode == FARNSWORTH)
+  while (EECR & (1 << EERIE))
   {
-    if ((dir == UP) && (farnsworth > 0))
-    {
-      farnsworth--;
-    }
-
-    if ((dir == DOWN) && (farnsworth < MAXFARN))
-    {
-      farnsworth++;
-    }
+    // Wait for the interrupt to empty the queue
+    ;
   }
-  // WPMSPEED  
-  else
-  {
-    if ((dir == UP) && (wpm < MAXWPM))
-    {
-      wpm++;
-    }
+}
 
-    if ((dir == DOWN) && (wpm > MINWPM))
-    {
-      wpm--;
-    }
 
-    // Calculate beats
-    wpmcnt = (1200 / YACKBEAT) / wpm;
-  }
+/*! 
+ @brief     Reads a byte from EEPROM once no writes are pending
+ 
+ For reads in loops that may queue writes in between (e.g. a speed change by
+ yackctrlkey saving the settings).
+ 
+ This is a private function.
+ 
+ @param src     EEPROM address to read from
+ @return        The byte read
+ 
+ */
+static byte yackeeread(const void *src)
+{
+  yackeeflush();
 
-  // Set the dirty flag
-  volflags |= DIRTYFLAG;
+  return (eeprom_read_byte((const byte *)src));
+}
+
+
+/*! 
+ @brief     Collects the stored settings into a configuration record
+ 
+ This is a private function.
+ 
+ @param cfg     Record to fill, including its checksum
+ 
+ */
+static void yackgetcfg(YACKCTX *ctx, struct YACKCFG *cfg)
+{
+  byte *p = (byte *)cfg;
+  byte i;
+
+  cfg->yackflags = ctx->yackflags;
+  cfg->ctcvalue = ctx->ctcvalue;
+  cfg->wpm = ctx->wpm;
+  cfg->farnsworth = ctx->farnsworth;
+  cfg->weight = ctx->weight;
+  cfg->dahratio = ctx->dahratio;
+  cfg->txcomp = ctx->txcomp;
+  cfg->latchwin[0] = ctx->latchwin[0];
+  cfg->latchwin[1] = ctx->latchwin[1];
+
+  // Checksum. Starts at MAGPAT so that an all zero record is invalid.
+  cfg->sum = MAGPAT;
 
-  yackplay(DIT);
-  yackdelay(IEGLEN);  // Inter Element gap
-  yackplay(DAH);
-  yackdelay(ICGLEN);  // Inter Character gap
-  yackfarns();        // Additional Farnsworth delay
+  for (i = 0; i < sizeof(*cfg) - 1; i++)
+  {
+    cfg->sum += p[i];
+  }
 }
 
 
 /*! 
- @brief     Heartbeat delay
+ @brief     Takes over the settings of a configuration record
  
- Several functions in the keyer are timing dependent. The most prominent example is the
- yackiambic function that implements the IAMBIC keyer finite state machine.
- The same expects to be called in intervals of YACKBEAT milliseconds. How this is 
- implemented is left to the user. In a more complex application this would be done
- using an interrupt or a timer. For simpler cases this is a busy wait routine
- that delays exactly YACKBEAT ms.
+ Nothing is changed if the checksum does not match (empty or damaged record).
+ The caller needs to validate the settings and rebuild the timing.
+ 
+ This is a private function.
+ 
+ @param cfg     The record
+ @return        TRUE if the record was valid
  
  */
-void yackbeat(void)
+static byte yacksetcfg(YACKCTX *ctx, const struct YACKCFG *cfg)
 {
-  while ((TIFR & (1 << OCF1A)) == 0)
+  const byte *p = (const byte *)cfg;
+  byte sum = MAGPAT;
+  byte i;
+
+  for (i = 0; i < sizeof(*cfg) - 1; i++)
   {
-    // Wait for Timeout
-    ;
+    sum += p[i];
   }
 
-  // Reset output compare flag
-  TIFR |= (1 << OCF1A);
+  if (sum != cfg->sum)
+  {
+    return (FALSE);
+  }
+
+  ctx->yackflags = cfg->yackflags;
+  ctx->ctcvalue = cfg->ctcvalue;
+  ctx->wpm = cfg->wpm;
+  ctx->farnsworth = cfg->farnsworth;
+  ctx->weight = cfg->weight;
+  ctx->dahratio = cfg->dahratio;
+  ctx->txcomp = cfg->txcomp;
+  ctx->latchwin[0] = cfg->latchwin[0];
+  ctx->latchwin[1] = cfg->latchwin[1];
+
+  return (TRUE);
 }
 
 
 /*! 
- @brief     Increases or decreases the sidetone pitch
+ @brief     Replaces settings that are out of range by their defaults
  
- Changes are done not in Hz but in ctc control values. This is to avoid extensive 
- calculations at runtime. As is all calculations are done by the preprocessor.
- 
- @param dir     UP or DOWN
+ This is a private function.
  
  */
-void yackpitch(byte dir)
+static void yackvalidate(YACKCTX *ctx)
 {
-  if (dir == UP)
+  if (ctx->wpm < MINWPM || ctx->wpm > MAXWPM)
   {
-    ctcvalue--;
+    ctx->wpm = DEFWPM;
   }
 
-  if (dir == DOWN)
+  // Older versions stored a count of extra dots here, not an effective WPM
+  if (ctx->farnsworth < MINWPM || ctx->farnsworth >= ctx->wpm)
   {
-    ctcvalue++;
+    ctx->farnsworth = 0;
   }
 
-  if (ctcvalue < MAXCTC)
+  if (ctx->weight < MINWEIGHT || ctx->weight > MAXWEIGHT)
   {
-    ctcvalue = MAXCTC;
+    ctx->weight = DEFWEIGHT;
   }
 
-  if (ctcvalue > MINCTC)
+  if (ctx->dahratio < MINRATIO || ctx->dahratio > MAXRATIO)
   {
-    ctcvalue = MINCTC;
+    ctx->dahratio = DEFRATIO;
   }
 
-  // Set the dirty flag
-  volflags |= DIRTYFLAG;
+  if (ctx->txcomp > MAXCOMP)
+  {
+    ctx->txcomp = DEFCOMP;
+  }
+
+  if (ctx->latchwin[0] > 100 || ctx->latchwin[1] > 100)
+  {
+    ctx->latchwin[0] = DEFLATCHA;
+    ctx->latchwin[1] = DEFLATCHB;
+  }
+
+  if (ctx->xflags & ~STRAIGHT)
+  {
+    ctx->xflags = 0;
+  }
 }
 
 
 /*! 
- @brief     Activates Tuning mode
+ @brief     Loads or stores a configuration profile
  
- This produces a solid keydown for TUNEDURATION seconds. After this the TX is unkeyed.
- The same can be achieved by presing either the DIT or the DAH contact or the control key.
+ A profile holds the flags, pitch, speed, Farnsworth and element timing settings.
  
-*/
-void yacktune(void)
+ In READ mode the profile becomes the active configuration and is saved right away.
+ The switch is atomic (see yacksave): after a power loss the keyer comes up either
+ with the old or with the new configuration, never with a mix. An empty or damaged
+ profile is refused.
+ 
+ In WRITE mode the active configuration is stored in the profile.
+ 
+ @param func    READ (load) or WRITE (store)
+ @param nr      1 to PROFILES
+ @return        TRUE if all OK, FALSE if the number or the profile was not valid
+ 
+ */
+byte yackprofile(YACKCTX *ctx, byte func, byte nr)
 {
-  word timer = YACKSECS(TUNEDURATION);
+  struct YACKCFG cfg;
 
-  key(DOWN);
+  if (nr < 1 || nr > PROFILES)
+  {
+    return (FALSE);
+  }
 
-  while (timer && (KEYINP & (1 << DITPIN)) && (KEYINP & (1 << DAHPIN)) && !yackctrlkey(TRUE))
+  if (func == WRITE)
   {
-    timer--;
-    yackbeat();
+    yackgetcfg(ctx, &cfg);
+    yackeewrite(&profstor[nr - 1], &cfg, sizeof(cfg));
+  }
+
+  if (func == READ)
+  {
+    yackeeflush();
+    eeprom_read_block(&cfg, &profstor[nr - 1], sizeof(cfg));
+
+    if (!yacksetcfg(ctx, &cfg))
+    {
+      return (FALSE);
+    }
+
+    yackvalidate(ctx);
+    yacktiming(ctx);
+    ctx->volflags |= DIRTYFLAG;
+    yacksave(ctx);
   }
 
-  key(UP);
+  return (TRUE);
 }
 
 
 /*! 
- @brief     Sets the keyer mode (e.g. IAMBIC A)
+ @brief     Inhibits keying during command phases
  
- This allows to set the content of the two mode bits in yackflags. Currently only
- two modes are supported, IAMBIC A and IAMBIC B.
+ This function is used to inhibit and re-enable TX keying (if configured) and enforce the internal 
+ sidetone oscillator to be active so that the user can communicate with the keyer.
  
- @param mode    IAMBICA or IAMBICB
- @return    TRUE is all was OK, FALSE if configuration lock prevented changes
+ @param mode   ON inhibits keying, OFF re-enables keying 
  
  */
-void yackmode(byte mode)
+void yackinhibit(YACKCTX *ctx, byte mode)
 {
-  yackflags &= ~MODE;
-  yackflags |= mode;
+  // Any background text ends here, in the middle of an element if need be
+  if (ctx->qtext)
+  {
+    ctx->qtext = NULL;
+    key(ctx, UP);
+    ctx->fsms = IDLE;
+    ctx->timer = 0;
+  }
 
-  // Set the dirty flag
-  volflags |= DIRTYFLAG;
+  if (mode)
+  {
+    ctx->volflags &= ~(TXKEY | SIDETONE);
+    ctx->volflags |= SIDETONE;
+  }
+  else
+  {
+    ctx->volflags &= ~(TXKEY | SIDETONE);
+    ctx->volflags |= (ctx->yackflags & (TXKEY | SIDETONE));
+
+    key(ctx, UP);
+  }
+}
+
+
+/*! 
+ @brief     Saves user defined settings
+ 
+ The routine using this library is given the opportunity to save up to four 16 bit sized
+ values in EEPROM. In case of the sample main function this is used to store the beacon 
+ schedule. The routine is not otherwise used by the library.
+ 
+ @param func    States if the data is retrieved (READ) or written (WRITE) to EEPROM
+ @param nr      1 to 4 (Number of user storage to access)
+ @param content The 16 bit word to write. Not used in read mode.
+ @return        The content of the retrieved value in read mode.
+ 
+ */
+word yackuser(YACKCTX *ctx, byte func, byte nr, word content)
+{
+  if (func == READ)
+  {
+    yackeeflush();
+
+    if (nr == 1)
+    {
+      return (eeprom_read_word(&user1));
+    }
+    else if (nr == 2)
+    {
+      return (eeprom_read_word(&user2));
+    }
+    else if (nr == 3)
+    {
+      return (eeprom_read_word(&user3));
+    }
+    else if (nr == 4)
+    {
+      return (eeprom_read_word(&user4));
+    }
+  }
+
+  if (func == WRITE)
+  {
+    if (nr == 1)
+    {
+      yackeeword(&user1, content);
+    }
+    else if (nr == 2)
+    {
+      yackeeword(&user2, content);
+    }
+    else if (nr == 3)
+    {
+      yackeeword(&user3, content);
+    }
+    else if (nr == 4)
+    {
+      yackeeword(&user4, content);
+    }
+  }
+
+  return (FALSE);
+}
+
+
+/*! 
+ @brief     Retrieves the current WPM speed
+ 
+ This function delivers the current WPM speed. 
+
+ @return        Current speed in WPM
+ 
+ */
+word yackwpm(YACKCTX *ctx)
+{
+  return ctx->wpm;
+}
+
+
+/*! 
+ @brief     Sets the WPM speed silently
+ 
+ Unlike yackspeed, nothing is played and the setting is not marked for saving.
+ This is meant for automatic speed changes. Values out of range are clamped.
+ 
+ @param n       Speed in WPM
+ 
+ */
+void yacksetwpm(YACKCTX *ctx, byte n)
+{
+  if (n < MINWPM)
+  {
+    n = MINWPM;
+  }
+
+  if (n > MAXWPM)
+  {
+    n = MAXWPM;
+  }
+
+  ctx->wpm = n;
+  yacktiming(ctx);
+}
+
+
+/*! 
+ @brief     Precomputes all element durations and gaps
+ 
+ The dot length for the current speed is taken from dottab in 1/16 beat fixed point.
+ From that the element table is built with shifts and 16 bit multiplications only:
+ 
+   dit = dot * weight / 16 + txcomp
+   dah = dot * dahratio / 8 + (dit - dot)
+   ieg = 2 * dot - dit
+ 
+ Weighting lengthens (or shortens) every keydown at the expense of the following gap,
+ so the element period does not change. The compensation is added on top to make up for
+ the time a transmitter needs to switch to TX.
+ 
+ The Farnsworth gaps implement the ARRL formula. Characters are sent at wpm while the total
+ spacing delay of a PARIS word is stretched so that the effective speed becomes
+ farnsworth WPM:
+ 
+   ta = 60000 / farnsworth - 37200 / wpm   [ms]
+   tc = 3 * ta / 19,  tw = 7 * ta / 19
+ 
+ They are stored as the number of beats that each gap exceeds the standard ICG / IWG.
+ A farnsworth setting of 0 or >= wpm disables the extra spacing.
+ 
+ This must be called whenever one of the timing settings changes.
+ 
+ This is a private function.
+ 
+ */
+static void yacktiming(YACKCTX *ctx)
+{
+  word dot;       // Dot length in 1/16 beats
+  word dit;       // Dit keydown in 1/16 beats
+  word gap;       // Element gap in 1/16 beats
+  uint32_t unit;  // 1/19 of the Farnsworth spacing time in 1/16 beats
+  word icg;       // Farnsworth inter-character gap in beats
+  byte open;      // Part of an element in percent during which paddles are latched
+
+  dot = pgm_read_word(&dottab[ctx->wpm - MINWPM]);
+  dit = (dot * ctx->weight) >> 4;
+  gap = 2 * dot - dit;
+
+  ctx->wpmcnt = (dot + 8) >> 4;
+  ctx->elements.dit = (dit + 8) >> 4;
+  ctx->elements.dah = (((dot * ctx->dahratio) >> 3) + dit - dot + 8) >> 4;
+  ctx->elements.ieg = (gap + 8) >> 4;
+
+  // Compensation comes out of the gap but leaves at least one beat
+  ctx->elements.dit += ctx->txcomp;
+  ctx->elements.dah += ctx->txcomp;
+
+  if (ctx->elements.ieg > ctx->txcomp)
+  {
+    ctx->elements.ieg -= ctx->txcomp;
+  }
+  else
+  {
+    ctx->elements.ieg = 1;
+  }
+
+  // Latch thresholds against the element countdown. Ultimatic and DAH priority
+  // latch in the gap only.
+  open = 0;
+
+  if ((ctx->yackflags & MODE) == IAMBICA)
+  {
+    open = 100 - ctx->latchwin[0];
+  }
+
+  if ((ctx->yackflags & MODE) == IAMBICB)
+  {
+    open = 100 - ctx->latchwin[1];
+  }
+
+  ctx->elements.ditlatch = (ctx->elements.dit * open + 50) / 100;
+  ctx->elements.dahlatch = (ctx->elements.dah * open + 50) / 100;
+
+  // A character is decoded after two dots of gap. The word gap timer started then
+  // has to run down by one more dot for a full inter-character gap.
+  ctx->elements.aspace = (IWGLEN - ICGLEN - 1) * ctx->wpmcnt;
+
+  ctx->farnsicg = 0;
+  ctx->farnsiwg = 0;
+
+  if (ctx->farnsworth && (ctx->farnsworth < ctx->wpm))
+  {
+    unit = (60000UL * ctx->wpm - 37200UL * ctx->farnsworth) * 16;
+    unit /= (uint32_t)ctx->farnsworth * ctx->wpm * 19 * YACKBEAT;
+
+    icg = (3 * unit + 8) >> 4;
+    ctx->farnsicg = icg - ICGLEN * ctx->wpmcnt;
+    ctx->farnsiwg = ((7 * unit + 8) >> 4) - icg - (IWGLEN - ICGLEN) * ctx->wpmcnt;
+
+    // Rounding must never make a gap shorter than the standard one
+    if (ctx->farnsicg & 0x8000)
+    {
+      ctx->farnsicg = 0;
+    }
+
+    if (ctx->farnsiwg & 0x8000)
+    {
+      ctx->farnsiwg = 0;
+    }
+  }
+}
+
+
+/*! 
+ @brief     Increases or decreases the current WPM speed
+ 
+ The amount of increase or decrease is in amounts of wpmcnt. Those are close to real
+ WPM in a 10ms heartbeat but can significantly differ at higher heartbeat speeds.
+ 
+ In FARNSWORTH mode the effective speed is changed instead. It can not exceed the
+ character speed; reaching the character speed switches Farnsworth spacing off.
+ 
+ WEIGHTING, DAHRATIO and TXCOMP step the respective element timing setting by one unit.
+ LATCHWIN steps the latch window of the current IAMBIC mode by LATCHSTEP percent.
+ 
+ @param dir     UP (faster / more) or DOWN (slower / less)
+ @param mode    WPMSPEED, FARNSWORTH, WEIGHTING, DAHRATIO, TXCOMP or LATCHWIN
+ 
+ */
+void yackspeed(YACKCTX *ctx, byte dir, byte mode)
+{
+  byte i;
+
+  if (mode == FARNSWORTH)
+  {
+    // Farnsworth off? Then start from the character speed
+    if (!ctx->farnsworth || (ctx->farnsworth > ctx->wpm))
+    {
+      ctx->farnsworth = ctx->wpm;
+    }
+
+    if ((dir == UP) && (ctx->farnsworth < ctx->wpm))
+    {
+      ctx->farnsworth++;
+    }
+
+    if ((dir == DOWN) && (ctx->farnsworth > MINWPM))
+    {
+      ctx->farnsworth--;
+    }
+
+    // Same effective speed as character speed = no Farnsworth
+    if (ctx->farnsworth == ctx->wpm)
+    {
+      ctx->farnsworth = 0;
+    }
+  }
+  else if (mode == WEIGHTING)
+  {
+    if ((dir == UP) && (ctx->weight < MAXWEIGHT))
+    {
+      ctx->weight++;
+    }
+
+    if ((dir == DOWN) && (ctx->weight > MINWEIGHT))
+    {
+      ctx->weight--;
+    }
+  }
+  else if (mode == DAHRATIO)
+  {
+    if ((dir == UP) && (ctx->dahratio < MAXRATIO))
+    {
+      ctx->dahratio++;
+    }
+
+    if ((dir == DOWN) && (ctx->dahratio > MINRATIO))
+    {
+      ctx->dahratio--;
+    }
+  }
+  else if (mode == LATCHWIN)
+  {
+    // Window of the current mode (IAMBIC A or B)
+    i = ((ctx->yackflags & MODE) == IAMBICB);
+
+    if ((dir == UP) && (ctx->latchwin[i] < 100))
+    {
+      ctx->latchwin[i] += LATCHSTEP;
+    }
+
+    if ((dir == DOWN) && (ctx->latchwin[i] >= LATCHSTEP))
+    {
+      ctx->latchwin[i] -= LATCHSTEP;
+    }
+  }
+  else if (mode == TXCOMP)
+  {
+    if ((dir == UP) && (ctx->txcomp < MAXCOMP))
+    {
+      ctx->txcomp++;
+    }
+
+    if ((dir == DOWN) && (ctx->txcomp > 0))
+    {
+      ctx->txcomp--;
+    }
+  }
+  // WPMSPEED  
+  else
+  {
+    if ((dir == UP) && (ctx->wpm < MAXWPM))
+    {
+      ctx->wpm++;
+    }
+
+    if ((dir == DOWN) && (ctx->wpm > MINWPM))
+    {
+      ctx->wpm--;
+    }
+  }
+
+  // Rebuild the element table
+  yacktiming(ctx);
+
+  // Set the dirty flag
+  ctx->volflags |= DIRTYFLAG;
+
+  yackplay(ctx, DIT);
+  yackplay(ctx, DAH);
+  yackdelay(ctx, ICGLEN - IEGLEN);  // Inter Character gap
+  yackfarns(ctx);                   // Additional Farnsworth delay
+}
+
+
+/*! 
+ @brief     Heartbeat delay
+ 
+ Several functions in the keyer are timing dependent. The most prominent example is the
+ yackiambic function that implements the IAMBIC keyer finite state machine.
+ The same expects to be called in intervals of YACKBEAT milliseconds. How this is 
+ implemented is left to the user. In a more complex application this would be done
+ using an interrupt or a timer. For simpler cases this is a busy wait routine
+ that delays exactly YACKBEAT ms.
+ 
+ The beat itself is flagged by the Timer1 interrupt. If the caller was busy for longer
+ than a beat, the routine returns immediately.
+ 
+ */
+void yackbeat(YACKCTX *ctx)
+{
+  while (!beatflag)
+  {
+    // Wait for Timeout
+    ;
+  }
+
+  // Reset beat flag
+  beatflag = 0;
+
+#ifdef PTTPIN
+  // Drop PTT once the hang time has passed without keying. The pin change ISR
+  // may key in straight key mode, so nothing must come in between.
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    if (ctx->ptttimer && !ctx->keyed && !--ctx->ptttimer)
+    {
+      CLEARBIT(PTTPORT, PTTPIN);
+    }
+  }
+#endif
+
+#ifdef SPEEDPOT
+  yackpot(ctx);
+#endif
+}
+
+
+#ifdef SPEEDPOT
+/*! 
+ @brief     Tracks the speed potentiometer
+ 
+ Called once per beat from yackbeat. The ADC conversion started on the previous beat has long
+ completed by then (a conversion takes about 0.1 ms), so the result is read without waiting
+ and the next conversion is started right away.
+ 
+ Readings go through an IIR low pass and are mapped linearly onto MINWPM..MAXWPM in 1/256 WPM
+ steps. The speed only changes when the pot has moved POTHYST beyond the boundary of the
+ WPM step it set last, so a pot sitting near a boundary does not make the speed jitter.
+ Comparing against the pot's own last step rather than the current speed also keeps speeds
+ set otherwise (paddles, _W in messages, the trainer) until the pot is moved. A new
+ speed only rebuilds the element table; nothing is played and nothing blocks. It is not
+ saved in EEPROM as the pot position is the reference after the next power up anyway.
+ 
+ This is a private function.
+ 
+ */
+static void yackpot(YACKCTX *ctx)
+{
+  word pos;  // Pot position in 1/256 WPM steps above MINWPM
+  word cur;  // Start of the current WPM step in the same units
+
+  // Conversion still running?
+  if (ADCSRA & (1 << ADSC))
+  {
+    return;
+  }
+
+  ctx->potfilt = ctx->potfilt - (ctx->potfilt >> POTIIR) + ADCH;
+  ADCSRA |= (1 << ADSC);
+
+  pos = (ctx->potfilt >> POTIIR) * (MAXWPM - MINWPM + 1);
+  cur = (word)(ctx->potwpm - MINWPM) << 8;
+
+  if ((pos + POTHYST < cur) || (pos >= cur + 256 + POTHYST))
+  {
+    ctx->potwpm = MINWPM + (pos >> 8);
+    yacksetwpm(ctx, ctx->potwpm);
+  }
+}
+#endif
+
+
+/*! 
+ @brief     Timer1 heartbeat interrupt
+ 
+ Fires every beat. It counts the beats for yacktime and flags the beat for yackbeat.
+ Unlike the beats seen by yackbeat, none of these get lost while the application is
+ busy, so yacktime stays in step with real time.
+ 
+ It also dithers the Timer1 period so that the mean beat is exactly YACKBEAT ms.
+ 
+ With SERIALPIN defined, it shifts out one bit of the serial output per beat.
+ 
+ */
+ISR(TIMER1_COMPA_vect)
+{
+  byte frac;
+
+  ticks++;
+  beatflag = 1;
+
+  // The counter is just past 1, so OCR1C can be changed for the current cycle. Add
+  // one count whenever the fractional counts add up to a whole one.
+  frac = beatfrac + T1FRAC;
+  OCR1C = (frac < beatfrac) ? T1WHOLE : T1WHOLE - 1;
+  beatfrac = frac;
+
+#ifdef SERIALPIN
+  // Frame the next character: start bit, 8 data bits, stop bit
+  if (!serframe && serhead != sertail)
+  {
+    serframe = ((word)serbuf[sertail] << 1) | 0x200;
+    sertail = (sertail + 1) & (SERBUF - 1);
+  }
+
+  // The stop bit leaves the line at idle level
+  if (serframe)
+  {
+    if (serframe & 1)
+    {
+      SETBIT(SERPORT, SERIALPIN);
+    }
+    else
+    {
+      CLEARBIT(SERPORT, SERIALPIN);
+    }
+
+    serframe >>= 1;
+  }
+#endif
+}
+
+
+/*! 
+ @brief     Free running time base
+ 
+ @return        Number of beats since yackinit. Wraps around after about 248 days.
+ 
+ */
+uint32_t yacktime(YACKCTX *ctx)
+{
+  uint32_t t;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    t = ticks;
+  }
+
+  return t;
+}
+
+
+#ifdef SERIALPIN
+/*! 
+ @brief     Queues a character for the serial output
+ 
+ Returns at once, the heartbeat interrupt sends the character in the background. At
+ 200 baud the output keeps up with any keying speed, so a character that finds the
+ buffer full is dropped rather than holding up the keyer.
+ 
+ @param c   Character to send
+ 
+ */
+void yacklog(YACKCTX *ctx, char c)
+{
+  byte next = (serhead + 1) & (SERBUF - 1);
+
+  if (next != sertail)
+  {
+    serbuf[serhead] = c;
+    serhead = next;
+  }
+}
+#endif
+
+
+/*! 
+ @brief     Increases or decreases the sidetone pitch
+ 
+ Changes are done not in Hz but in ctc control values. This is to avoid extensive 
+ calculations at runtime. As is all calculations are done by the preprocessor.
+ 
+ @param dir     UP or DOWN
+ 
+ */
+void yackpitch(YACKCTX *ctx, byte dir)
+{
+  if (dir == UP)
+  {
+    ctx->ctcvalue--;
+  }
+
+  if (dir == DOWN)
+  {
+    ctx->ctcvalue++;
+  }
+
+  if (ctx->ctcvalue < MAXCTC)
+  {
+    ctx->ctcvalue = MAXCTC;
+  }
+
+  if (ctx->ctcvalue > MINCTC)
+  {
+    ctx->ctcvalue = MINCTC;
+  }
+
+  // Set the dirty flag
+  ctx->volflags |= DIRTYFLAG;
+}
+
+
+/*! 
+ @brief     Activates Tuning mode
+ 
+ This produces a solid keydown for TUNEDURATION seconds. After this the TX is unkeyed.
+ The same can be achieved by presing either the DIT or the DAH contact or the control key.
+ 
+*/
+void yacktune(YACKCTX *ctx)
+{
+  word timer = YACKSECS(TUNEDURATION);
+
+  key(ctx, DOWN);
+
+  while (timer && (KEYINP & (1 << DITPIN)) && (KEYINP & (1 << DAHPIN)) && !yackctrlkey(ctx, TRUE))
+  {
+    timer--;
+    yackbeat(ctx);
+  }
+
+  key(ctx, UP);
+}
+
+
+/*! 
+ @brief     Calibrates the internal RC oscillator
+ 
+ Produces a continuous CALFREQ reference tone which is derived from the CPU clock.
+ The user compares it against an accurate reference (tuner, receiver or app) and
+ lowers (DIT) or raises (DAH) the clock until both match. Each step changes OSCCAL by one;
+ holding a paddle repeats the step every CALREPEAT beats. OSCCAL has two overlapping ranges
+ (bit 7); the steps stay within the current one and stop at its ends, so the clock can not
+ jump or wrap out of its safe range. The mode ends after DEFTIMEOUT
+ seconds without paddle activity or when the control key is pressed. The new calibration
+ is marked for saving and restored from EEPROM by yackinit.
+ 
+ As all keyer timing is derived from the same clock, this also calibrates sending speed
+ and beacon intervals.
+ 
+*/
+void yackcalibrate(YACKCTX *ctx)
+{
+  word timer = YACKSECS(DEFTIMEOUT);
+  byte rpt = 0;
+
+  while (timer && !yackctrlkey(ctx, TRUE))
+  {
+    // The reference tone goes to Timer0 directly and ctcvalue keeps the pitch, as a
+    // speed change through the control key saves it. That change also beeps at the
+    // keyer pitch and leaves the tone off, so it is started again.
+    if (!ctx->keyed)
+    {
+      key(ctx, DOWN);
+      OCR0A = CALCTC;
+      OCR0B = CALCTC;
+    }
+
+    timer--;
+    yackbeat(ctx);
+
+    if (rpt)
+    {
+      rpt--;
+    }
+    else if (!(KEYINP & (1 << DITPIN)))
+    {
+      if (OSCCAL & 0x7F)
+      {
+        OSCCAL--;
+      }
+
+      rpt = CALREPEAT;
+      timer = YACKSECS(DEFTIMEOUT);
+      ctx->volflags |= DIRTYFLAG;
+    }
+    else if (!(KEYINP & (1 << DAHPIN)))
+    {
+      if ((OSCCAL & 0x7F) != 0x7F)
+      {
+        OSCCAL++;
+      }
+
+      rpt = CALREPEAT;
+      timer = YACKSECS(DEFTIMEOUT);
+      ctx->volflags |= DIRTYFLAG;
+    }
+  }
+
+  key(ctx, UP);
+}
+
+
+/*! 
+ @brief     Sets the keyer mode (e.g. IAMBIC A)
+ 
+ This allows to set the content of the two mode bits in yackflags. Currently only
+ two modes are supported, IAMBIC A and IAMBIC B.
+ 
+ @param mode    IAMBICA or IAMBICB
+ @return    TRUE is all was OK, FALSE if configuration lock prevented changes
+ 
+ */
+void yackmode(YACKCTX *ctx, byte mode)
+{
+  ctx->yackflags &= ~MODE;
+  ctx->yackflags |= mode;
+
+  // The latch window depends on the mode
+  yacktiming(ctx);
+
+  // Set the dirty flag
+  ctx->volflags |= DIRTYFLAG;
 }
 
 
@@ -601,9 +1580,9 @@ void yackmode(byte mode)
  @return     0 if the flag(s) were clear, >0 if flag(s) were set
  
  */
-byte yackflag(byte flag)
+byte yackflag(YACKCTX *ctx, byte flag)
 {
-  return yackflags & flag;
+  return ctx->yackflags & flag;
 }
 
 
@@ -617,13 +1596,36 @@ byte yackflag(byte flag)
  @return    TRUE if all was OK, FALSE if configuration lock prevented changes
  
  */
-void yacktoggle(byte flag)
+void yacktoggle(YACKCTX *ctx, byte flag)
 {
   // Toggle the feature bit
-  yackflags ^= flag;
+  ctx->yackflags ^= flag;
 
   // Set the dirty flag
-  volflags |= DIRTYFLAG;
+  ctx->volflags |= DIRTYFLAG;
+}
+
+
+/*! 
+ @brief     Toggle extended feature flags
+ 
+ Same as yacktoggle, for the flags in xflags (e.g. STRAIGHT).
+ 
+ @param flag    A byte where any bit to toggle is set
+ 
+ */
+void yackxtoggle(YACKCTX *ctx, byte flag)
+{
+  ctx->xflags ^= flag;
+
+  // Start over with the new way of keying
+  key(ctx, UP);
+  ctx->volflags &= ~(DITLATCH | DAHLATCH);
+  ctx->fsms = IDLE;
+  ctx->timer = 0;
+  ctx->buffer = ctx->bcntr = 0;
+
+  ctx->volflags |= DIRTYFLAG;
 }
 
 
@@ -634,17 +1636,16 @@ void yacktoggle(byte flag)
  function produces it..
  
  */
-void yackerror(void)
+void yackerror(YACKCTX *ctx)
 {
   byte i;
 
   for (i = 0; i < 8; i++)
   {
-    yackplay(DIT);
-    yackdelay(DITLEN);
+    yackplay(ctx, DIT);
   }
 
-  yackdelay(DAHLEN);
+  yackdelay(ctx, DAHLEN);
 }
 
 
@@ -659,21 +1660,82 @@ void yackerror(void)
  the feature register. This function also handles a request to invert the keyer line
  if necessary (TXINV bit).
  
+ If the TX line is OC1A, the TX edge is not set here but by the Timer1 compare match that
+ also marks the next beat. Callers key right after yackbeat, so every edge is delayed by
+ the same single beat and lands within microseconds of the beat, independent of the
+ code that runs in between. The sidetone still switches immediately.
+ 
+ With a PTT output configured, PTT is raised PTTLEAD ms ahead of the TX edge of the
+ first element; yackbeat drops it again after PTTHANG ms without keying. With OC1A the
+ beat the edge waits for is part of that lead, so only PTTLEAD - YACKBEAT ms are waited
+ here, and the edge of an element that woke the keyer is not forced out early.
+ 
+ Whoever keys here takes over from the straight key pass-through, which stays off
+ until yackiambic arms it again.
+ 
  This is a private function.
 
  @param mode    UP or DOWN
  
  */
-static void key(byte mode)
+static void key(YACKCTX *ctx, byte mode)
 {
+  passarm = 0;
+
+#ifdef PTTPIN
+  // Switch the transmitter over before the first element. The hang time
+  // restarts with every element and only runs out while the key is up.
+  if (mode == DOWN && (ctx->volflags & TXKEY) && !ctx->keyed)
+  {
+    if (!ctx->ptttimer)
+    {
+      SETBIT(PTTPORT, PTTPIN);
+
+#if defined(TXOC1A) && (PTTLEAD >= YACKBEAT)
+      // The OC1A edge comes one beat after key()
+      yackwait(ctx, YACKMS(PTTLEAD) - 1);
+
+#ifdef POWERSAVE
+      woke = FALSE;
+#endif
+#else
+      yackwait(ctx, YACKMS(PTTLEAD));
+#endif
+    }
+
+    ctx->ptttimer = YACKMS(PTTHANG);
+  }
+#endif
+
+#ifdef TELEMETRY
+  word now;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+  {
+    now = ticks;
+  }
+
+  if (mode == DOWN && !ctx->keyed)
+  {
+    ctx->tlm.keystamp = now;
+  }
+
+  if (mode == UP && ctx->keyed)
+  {
+    ctx->tlm.keydown += (word)(now - ctx->tlm.keystamp);
+  }
+#endif
+
   if (mode == DOWN)
   {
+    ctx->keyed = 1;
+
     // Are we generating a Sidetone?    
-    if (volflags & SIDETONE)
+    if (ctx->volflags & SIDETONE)
     {
       // Then switch on the Sidetone generator
-      OCR0A = ctcvalue;
-      OCR0B = ctcvalue;
+      OCR0A = ctx->ctcvalue;
+      OCR0B = ctx->ctcvalue;
 
       // Activate CTC mode
       TCCR0A |= (1 << COMSTPIN | 1 << WGM01);
@@ -683,10 +1745,14 @@ static void key(byte mode)
     }
 
     // Are we keying the TX?
-    if (volflags & TXKEY)
+    if (ctx->volflags & TXKEY)
     {
+#ifdef TXOC1A
+      // Key at the next beat (active low if inverted)
+      TCCR1 = (TCCR1 & ~OC1ASET) | ((ctx->yackflags & TXINV) ? OC1ACLR : OC1ASET);
+#else
       // Do we need to invert keying?
-      if (yackflags & TXINV)
+      if (ctx->yackflags & TXINV)
       {
         CLEARBIT(OUTPORT, OUTPIN);
       }
@@ -694,23 +1760,30 @@ static void key(byte mode)
       {
         SETBIT(OUTPORT, OUTPIN);
       }
+#endif
     }
   }
 
   if (mode == UP)
   {
+    ctx->keyed = 0;
+
     // Sidetone active?
-    if (volflags & SIDETONE)
+    if (ctx->volflags & SIDETONE)
     {
       TCCR0A = 0;
       TCCR0B = 0;
     }
 
     // Are we keying the TX?
-    if (volflags & TXKEY)
+    if (ctx->volflags & TXKEY)
     {
+#ifdef TXOC1A
+      // Unkey at the next beat
+      TCCR1 = (TCCR1 & ~OC1ASET) | ((ctx->yackflags & TXINV) ? OC1ASET : OC1ACLR);
+#else
       // Do we need to invert keying?
-      if (yackflags & TXINV)
+      if (ctx->yackflags & TXINV)
       {
         SETBIT(OUTPORT, OUTPIN);
       }
@@ -718,6 +1791,7 @@ static void key(byte mode)
       {
         CLEARBIT(OUTPORT, OUTPIN);
       }
+#endif
     }
   }
 }
@@ -726,14 +1800,28 @@ static void key(byte mode)
 /*! 
  @brief     Produces an additional waiting delay for farnsworth mode.
  
+ Stretches an inter-character gap to its Farnsworth length (see yacktiming).
+ 
  */
-void yackfarns(void)
+void yackfarns(YACKCTX *ctx)
 {
-  word i = farnsworth;
+  yackwait(ctx, ctx->farnsicg);
+}
 
-  while (i--)
+
+/*! 
+ @brief     Produces an active waiting delay for n beats
+ 
+ This is a private function.
+ 
+ @param n   number of beats to delay
+ 
+ */
+static void yackwait(YACKCTX *ctx, word n)
+{
+  while (n--)
   {
-    yackdelay(1);
+    yackbeat(ctx);
   }
 }
 
@@ -746,18 +1834,18 @@ void yackfarns(void)
  @param n   number of dot durations to delay (dependent on current keying speed!
  
  */
-void yackdelay(byte n)
+void yackdelay(YACKCTX *ctx, byte n)
 {
   byte i = n;
   byte x;
 
   while (i--)
   {
-    x = wpmcnt;
+    x = ctx->wpmcnt;
 
     while (x--)
     {
-      yackbeat();
+      yackbeat(ctx);
     }
   }
 }
@@ -767,133 +1855,316 @@ void yackdelay(byte n)
 /*! 
  @brief     Key the TX / Sidetone for the duration of a dit or a dah
  
+ Durations come from the element table, so weighting and TX compensation apply.
+ The element is followed by the (weighted) inter-element gap.
+ 
  @param i   DIT or DAH
  
  */
-void yackplay(byte i)
+void yackplay(YACKCTX *ctx, byte i)
 {
-  key(DOWN);
+  key(ctx, DOWN);
 
 #ifdef POWERSAVE
-  yackpower(FALSE);  // Avoid powerdowns when keying
+  yackpower(ctx, FALSE);  // Avoid powerdowns when keying
 #endif
 
   switch (i)
   {
     case DAH:
-      yackdelay(DAHLEN);
+      yackwait(ctx, ctx->elements.dah);
       break;
 
     case DIT:
-      yackdelay(DITLEN);
+      yackwait(ctx, ctx->elements.dit);
       break;
   }
-
-  key(UP);
+
+  key(ctx, UP);
+
+  // Inter Element gap
+  yackwait(ctx, ctx->elements.ieg);
+}
+
+
+/*! 
+ @brief     Send a character in morse code
+ 
+ This function translates a character passed as parameter into morse code using the 
+ translation table in Flash memory. It then keys transmitter / sidetone with the characters
+ elements and adds all necessary gaps (as if the character was part of a longer word).
+ 
+ If the character can not be translated, nothing is sent.
+ 
+ If a space is received, an interword gap is sent.
+  
+ @param c   The character to send
+ 
+*/
+void yackchar(YACKCTX *ctx, char c)
+{
+  byte code = 0x80;  // 0x80 is an empty morse character (just eoc bit set)
+  byte i;            // a counter
+
+  // First we need to map the actual character to the encoded morse sequence in
+  // the array "morse"
+
+  // Is it a numerical digit?
+  if (c >= '0' && c <= '9')
+  {
+    // Find it in the beginning of array
+    code = pgm_read_byte(&morse[c - '0']);
+  }
+
+  // Is it a character?
+  if (c >= 'a' && c <= 'z')
+  {
+    // Find it from position 10
+    code = pgm_read_byte(&morse[c - 'a' + 10]);
+  }
+
+  // Is it a character in upper case?
+  if (c >= 'A' && c <= 'Z')
+  {
+    // Same as above
+    code = pgm_read_byte(&morse[c - 'A' + 10]);
+  }
+
+  // Last we need to handle special characters. There is a small char
+  // array "spechar" which contains the characters for the morse elements
+  // at the end of the "morse" array (see there!)
+
+  // Read through the array
+  for (i = 0; i < sizeof(spechar) - 1; i++)
+  {
+    // Does it contain our character    
+    if (c == pgm_read_byte(&spechar[i]))
+    {
+      // Map it to morse code
+      code = pgm_read_byte(&morse[i + 36]);
+    }
+  }
+
+  // Do they want us to transmit a space (a gap of 7 dots)
+  if (c == ' ')
+  {
+    yackspace(ctx);
+  }
+  else
+  {
+    yacksymbol(ctx, code);
+  }
+}
+
+
+/*! 
+ @brief     Sends one encoded character
+ 
+ Plays the elements of a character in YACK CW notation (see MORSECODES) followed by the
+ inter-character gap. 0x80 (no elements) only produces the gap.
+ 
+ The whole character is first turned into a run-length schedule: the keydown and the
+ following key-up beats of each element, the last gap stretched to the (Farnsworth)
+ inter-character gap. yackrun then only has to count beats, so table lookup and
+ schedule arithmetic never sit between two edges.
+ 
+ This is a private function.
+ 
+ @param code    The character in YACK CW notation
+ 
+*/
+static void yacksymbol(YACKCTX *ctx, byte code)
+{
+  word run[2 * MAXELEMENTS];  // Keydown and key-up beats per element
+  word gap;                   // Inter-character gap after the last element
+  byte n = 0;
+
+#ifdef TELEMETRY
+  yackcount(&ctx->tlm.sent);
+#endif
+
+  // Stop when EOC bit has reached MSB
+  while (code != 0x80)
+  {
+    // MSB set = dah, cleared = dit
+    run[n++] = (code & 0x80) ? ctx->elements.dah : ctx->elements.dit;
+    run[n++] = ctx->elements.ieg;
+
+    // Shift code on position left (to next element)
+    code = code << 1;
+  }
+
+  // IEG is part of the gap, add Farnsworth spacing
+  gap = (ICGLEN - IEGLEN) * ctx->wpmcnt + ctx->farnsicg;
+
+  if (n)
+  {
+    run[n - 1] += gap;
+
+#ifdef POWERSAVE
+    yackpower(ctx, FALSE);  // Avoid powerdowns when keying
+#endif
+
+    yackrun(ctx, run, n);
+  }
+  else
+  {
+    yackwait(ctx, gap);
+  }
+}
+
+
+/*! 
+ @brief     Plays a run-length keying schedule
+ 
+ Alternates keydown (even entries) and key-up (odd entries) for the given number of
+ beats each. Every edge is set right after the beat it belongs to, before anything else
+ is done in that beat. The command key is polled at the start of each gap (it blocks
+ while pressed) and aborts the rest of the schedule.
+ 
+ The final beat of the last gap is left to whatever is played next: it waits for that
+ beat (with yackbeat) before its own first edge. That way even the time spent preparing
+ the next character does not shift its first edge.
+ 
+ This is a private function.
+ 
+ @param run     Beats per entry, starting with a keydown
+ @param n       Number of entries
+ 
+*/
+static void yackrun(YACKCTX *ctx, const word *run, byte n)
+{
+  byte i;
+
+  for (i = 0; i < n; i++)
+  {
+    yackbeat(ctx);
+    key(ctx, (i & 1) ? UP : DOWN);
+
+    // Stop playing if someone pushes key
+    if ((i & 1) && yackctrlkey(ctx, FALSE))
+    {
+      return;
+    }
+
+    yackwait(ctx, run[i] - 1);
+  }
+}
+
+
+/*! 
+ @brief     Sends a word space
+ 
+ The inter-character gap was already played after the previous character.
+ 
+ This is a private function.
+ 
+*/
+static void yackspace(YACKCTX *ctx)
+{
+  // ICG was already played after previous char
+  yackdelay(ctx, IWGLEN - ICGLEN);
+
+  // Stretch to the Farnsworth word gap
+  yackwait(ctx, ctx->farnsiwg);
+}
+
+
+/*! 
+ @brief     Sends a text in CW that was encoded at compile time
+ 
+ Plays a text defined with YACKCW. The characters are already in YACK CW notation
+ so no table lookup is needed.
+ 
+ @param p   Pointer to the encoded text in FLASH
+ 
+ */
+void yackcode(YACKCTX *ctx, const byte *p)
+{
+  byte code;
+
+  // While end of text not reached and ctrl not pressed
+  while ((code = pgm_read_byte(p++)) && !(yackctrlkey(ctx, FALSE)))
+  {
+    if (code == 0x80)
+    {
+      yackspace(ctx);
+    }
+    else
+    {
+      yacksymbol(ctx, code);
+    }
+  }
 }
 
 
 /*! 
- @brief     Send a character in morse code
- 
- This function translates a character passed as parameter into morse code using the 
- translation table in Flash memory. It then keys transmitter / sidetone with the characters
- elements and adds all necessary gaps (as if the character was part of a longer word).
+ @brief     Queues a text that was encoded at compile time for background play
  
- If the character can not be translated, nothing is sent.
+ Unlike yackcode this returns at once. The text is played on the sidetone only by
+ yackiambic, one element per call, so the keyer is usable right away. Touching a paddle
+ ends the text immediately and sends the paddle's element in the same beat. Command
+ mode (or any other call of yackinhibit) also ends it.
  
- If a space is received, an interword gap is sent.
-  
- @param c   The character to send
+ @param p   Pointer to the encoded text in FLASH (see YACKCW)
  
-*/
-void yackchar(char c)
+ */
+void yackqueue(YACKCTX *ctx, const byte *p)
 {
-  byte code = 0x80;  // 0x80 is an empty morse character (just eoc bit set)
-  byte i;            // a counter
+  yackinhibit(ctx, ON);  // Sidetone only, ends any previous text
 
-  // First we need to map the actual character to the encoded morse sequence in
-  // the array "morse"
+  ctx->qtext = p;
+  ctx->qcode = 0x80;     // Nothing left of the current character
+  ctx->fsms = IDLE;
+  ctx->timer = 0;
+}
 
-  // Is it a numerical digit?
-  if (c >= '0' && c <= '9')
-  {
-    // Find it in the beginning of array
-    code = pgm_read_byte(&morse[c - '0']);
-  }
 
-  // Is it a character?
-  if (c >= 'a' && c <= 'z')
-  {
-    // Find it from position 10
-    code = pgm_read_byte(&morse[c - 'a' + 10]);
-  }
+/*! 
+ @brief     Keys the next element of the queued text
+ 
+ Called from yackiambic when the previous element and its gap are over. Fetches the
+ next character when the current one is done. Word spaces become a gap in IDLE state,
+ the end of the text re-enables normal keying.
+ 
+ This is a private function.
+ 
+ */
+static void yacknext(YACKCTX *ctx)
+{
+  byte code = ctx->qcode;
 
-  // Is it a character in upper case?
-  if (c >= 'A' && c <= 'Z')
+  // Current character complete?
+  if (code == 0x80)
   {
-    // Same as above
-    code = pgm_read_byte(&morse[c - 'A' + 10]);
-  }
-
-  // Last we need to handle special characters. There is a small char
-  // array "spechar" which contains the characters for the morse elements
-  // at the end of the "morse" array (see there!)
+    code = pgm_read_byte(ctx->qtext++);
 
-  // Read through the array
-  for (i = 0; i < sizeof(spechar); i++)
-  {
-    // Does it contain our character    
-    if (c == pgm_read_byte(&spechar[i]))
+    // End of text
+    if (!code)
     {
-      // Map it to morse code
-      code = pgm_read_byte(&morse[i + 36]);
+      yackinhibit(ctx, OFF);
+      return;
     }
-  }
 
-  // Do they want us to transmit a space (a gap of 7 dots)
-  if (c == ' ')
-  {
-    // ICG was already played after previous char
-    yackdelay(IWGLEN - ICGLEN);
-  }
-  else
-  {
-    // Stop when EOC bit has reached MSB
-    while (code != 0x80)
+    // Word space, the character gap has been waited for already
+    if (code == 0x80)
     {
-      // Stop playing if someone pushes key
-      if (yackctrlkey(FALSE))
-      {
-        return;
-      }
-
-      // MSB set ?
-      if (code & 0x80)
-      {
-        // ..then play a dash
-        yackplay(DAH);
-      }
-      // MSB cleared ?
-      else
-      {
-        // .. then play a dot
-        yackplay(DIT);
-      }
-
-      // Inter Element gap
-      yackdelay(IEGLEN);
-
-      // Shift code on position left (to next element)
-      code = code << 1;
+      ctx->fsms = IDLE;
+      ctx->timer = (IWGLEN - ICGLEN) * ctx->wpmcnt + ctx->farnsiwg;
+      return;
     }
 
-    // IEG was already played after element
-    yackdelay(ICGLEN - IEGLEN);
-
-    // Insert another gap for farnsworth keying
-    yackfarns();
+#ifdef TELEMETRY
+    yackcount(&ctx->tlm.sent);
+#endif
   }
+
+  // MSB set = dah, cleared = dit
+  ctx->timer = (code & 0x80) ? ctx->elements.dah : ctx->elements.dit;
+  ctx->qcode = code << 1;
+
+  key(ctx, DOWN);
+  ctx->fsms = KEYED;
 }
 
 
@@ -906,15 +2177,15 @@ void yackchar(char c)
  @param p   Pointer to string location in FLASH 
  
  */
-void yackstring(const char *p)
+void yackstring(YACKCTX *ctx, const char *p)
 {
   char c;
 
   // While end of string in flash not reached and ctrl not pressed
-  while ((c = pgm_read_byte(p++)) && !(yackctrlkey(FALSE)))
+  while ((c = pgm_read_byte(p++)) && !(yackctrlkey(ctx, FALSE)))
   {
     // Play the read character
-    yackchar(c);
+    yackchar(ctx, c);
 
     // abort now if someone presses command key
   }
@@ -929,32 +2200,32 @@ void yackstring(const char *p)
  @param n   The number to send
  
  */
-void yacknumber(word n)
+void yacknumber(YACKCTX *ctx, word n)
 {
   char buffer[5];
   byte i = 0;
 
-  // Until nothing left or control key pressed
-  while (n)
+  // Until nothing left (but at least one digit)
+  do
   {
     // Store rest of division by 10
     buffer[i++] = n % 10 + '0';
 
     // Divide by 10
     n /= 10;
-  }
+  } while (n);
 
   while (i)
   {
-    if (yackctrlkey(FALSE))
+    if (yackctrlkey(ctx, FALSE))
     {
       break;
     }
 
-    yackchar(buffer[--i]);
+    yackchar(ctx, buffer[--i]);
   }
 
-  yackchar(' ');
+  yackchar(ctx, ' ');
 }
 
 
@@ -971,23 +2242,76 @@ void yacknumber(word n)
  
  This is a private function.
 
+ @param pins    Contacts to latch, a set bit at DITPIN or DAHPIN means closed
+ 
  */
-static void keylatch(void)
+static void keylatch(YACKCTX *ctx, byte pins)
 {
   // Status of swap flag
   byte swap;
 
-  swap = (yackflags & PDLSWAP);
+  swap = (ctx->yackflags & PDLSWAP);
+
+  if (pins & (1 << DITPIN))
+  {
+    ctx->volflags |= (swap ? DAHLATCH : DITLATCH);
+  }
 
-  if (!(KEYINP & (1 << DITPIN)))
+  if (pins & (1 << DAHPIN))
   {
-    volflags |= (swap ? DAHLATCH : DITLATCH);
+    ctx->volflags |= (swap ? DITLATCH : DAHLATCH);
   }
+}
+
+
+/*! 
+ @brief     Keys the straight key pass-through
+ 
+ Unlike the paddle elements, straight key edges are not aligned to the beat. With TX on
+ OC1A the edge is therefore forced out right away.
+ 
+ This is a private function.
+ 
+ @param mode    UP or DOWN
+ 
+ */
+static void passkey(YACKCTX *ctx, byte mode)
+{
+  key(ctx, mode);
+
+#ifdef TXOC1A
+  GTCCR |= (1 << FOC1A);  // Apply the TX edge now, not at the next beat
+#endif
+}
+
+
+/*! 
+ @brief     Arms the straight key pass-through
+ 
+ Called every beat in straight key mode. The pin change ISR keys on every contact
+ edge as long as it is armed. Here the key is brought in line with the contact
+ for whatever the ISR could not do: the PTT lead time, or a contact that changed
+ while playback or command mode had the key.
+ 
+ This is a private function.
+ 
+ */
+static void yackpass(YACKCTX *ctx)
+{
+  byte mode;
+
+  // Keep the ISR out before sampling, so it can not key between the sample and
+  // key() below. An edge from now on is caught here or on the next beat.
+  passarm = 0;
+
+  mode = (~KEYINP & ((1 << DITPIN) | (1 << DAHPIN))) ? DOWN : UP;
 
-  if (!(KEYINP & (1 << DAHPIN)))
+  if ((mode == DOWN) != (ctx->keyed != 0))
   {
-    volflags |= (swap ? DITLATCH : DAHLATCH);
+    passkey(ctx, mode);
   }
+
+  passarm = 1;
 }
 
 
@@ -1007,12 +2331,12 @@ static void keylatch(void)
  @callergraph
  
  */
-byte yackctrlkey(byte mode)
+byte yackctrlkey(YACKCTX *ctx, byte mode)
 {
   byte volbfr;
 
   // Remember current volatile settings
-  volbfr = volflags;
+  volbfr = ctx->volflags;
 
   // If command button is pressed
   if (!(BTNINP & (1 << BTNPIN)))
@@ -1026,93 +2350,294 @@ byte yackctrlkey(byte mode)
     // Should we find that someone is keying the paddle, let him change
     // the speed and pretend ctrl was never pressed in the first place..
 
-    // Stop keying, switch on sidetone.
-    yackinhibit(ON);
+    // Stop keying, switch on sidetone.
+    yackinhibit(ctx, ON);
+
+    _delay_ms(50);
+
+    // Busy wait for release
+    while (!(BTNINP & (1 << BTNPIN)))
+    {
+      // Someone pressing DIT paddle
+      if (!(KEYINP & (1 << DITPIN)))
+      {
+        yackspeed(ctx, DOWN, WPMSPEED);
+        // Ignore that control key was pressed
+        volbfr &= ~(CKLATCH);
+      }
+
+      // Someone pressing DAH paddle
+      if (!(KEYINP & (1 << DAHPIN)))
+      {
+        yackspeed(ctx, UP, WPMSPEED);
+        volbfr &= ~(CKLATCH);
+      }
+    }
+
+    // Trailing edge debounce
+    _delay_ms(50);
+
+    // In case we had a speed change
+    yacksave(ctx);
+  }
+
+  // Restore previous state
+  ctx->volflags = volbfr;
+
+  // Does caller want us to reset latch?
+  if (mode == TRUE)
+  {
+    ctx->volflags &= ~(CKLATCH);
+  }
+
+  // In case we had a speed change (Does NOT work if command is here - moved immediately after button release debounce)
+  // yacksave();
+
+  // Tell caller if we had a ctrl button press
+  return ((volbfr & CKLATCH) != 0);
+}
+
+
+/*! 
+ @brief     Reverse maps a combination of dots and dashes to a character
+ 
+ This routine is passed a sequence of dots and dashes in the format we use for morse
+ character encoding (see top of this file). It looks up the corresponding character in
+ the Flash table and returns it to the caller. 
+ 
+ This is a private function.
+ 
+ @param buffer    A character in YACK CW notation
+ @return          The mapped character or /0 if no match was found  
+ 
+ */
+static char morsechar(byte buffer)
+{
+  byte i;
+
+  for (i = 0; i < sizeof(morse); i++)
+  {
+    if (pgm_read_byte(&morse[i]) == buffer)
+    {
+      // First 10 chars are digits
+      if (i < 10)
+      { 
+        return ('0' + i);
+      }
+
+      // Then follow letters
+      if (i < 36)
+      {
+        return ('A' + i - 10);
+      }
+
+      // Then special chars
+	    return (pgm_read_byte(&spechar[i - 36]));
+    }
+  }
+
+  return '\0';
+}
+
+
+/*! 
+ @brief     Returns the EEPROM location of a message
+ 
+ This is a private function.
+ 
+ @param msgnr   1 or 2 or 3 or 4
+ @return        Start of the message buffer in EEPROM
+ 
+ */
+static char *yackmsgaddr(byte msgnr)
+{
+  if (msgnr == 1)
+  {
+    return eebuffer1;
+  }
+
+  if (msgnr == 2)
+  {
+    return eebuffer2;
+  }
+
+  if (msgnr == 3)
+  {
+    return eebuffer3;
+  }
+
+  return eebuffer4;
+}
+
+
+/*! 
+ @brief     Sends a message character, optionally with cut numbers
+ 
+ This is a private function.
+ 
+ @param c       The character to send
+ @param cut     TRUE if 0 and 9 are to be sent as T and N
+ 
+ */
+static void yackmacchar(YACKCTX *ctx, char c, byte cut)
+{
+  if (cut)
+  {
+    if (c == '0')
+    {
+      c = 'T';
+    }
+
+    if (c == '9')
+    {
+      c = 'N';
+    }
+  }
+
+  yackchar(ctx, c);
+}
+
+
+/*! 
+ @brief     Reads or writes the contest serial number
+ 
+ The serial number is sent by the _N macro code and advances by one each
+ time a message containing it has been played completely.
+ 
+ @param func    READ or WRITE
+ @param n       The next serial number to send. Not used in read mode.
+ @return        The next serial number in read mode.
+ 
+ */
+word yackserial(YACKCTX *ctx, byte func, word n)
+{
+  if (func == WRITE)
+  {
+    yackeeword(&serstor, n);
+  }
+
+  yackeeflush();
+
+  return (eeprom_read_word(&serstor));
+}
+
+
+/*! 
+ @brief     Records a message from the paddles into EEPROM
+ 
+ See yackmessage. This is a private function, kept apart so that only recording
+ reserves the message sized buffer on the stack.
+ 
+ @param     msgnr       1 or 2 or 3 or 4
+ 
+ */
+static void yackrecord(YACKCTX *ctx, byte msgnr)
+{
+  unsigned char rambuffer[RBSIZE];  // Storage for the message
+  unsigned char c;                  // Work character
+
+  word extimer = 0;  // Detects end of message (10 sec)
+
+  byte i = 0;  // Pointer into RAM buffer
 
-    _delay_ms(50);
+  // 5 Second until message end
+  extimer = YACKSECS(DEFTIMEOUT);
 
-    // Busy wait for release
-    while (!(BTNINP & (1 << BTNPIN)))
+  // Continue until we waited 10 seconds
+  while (extimer--)
+  {
+    if (yackctrlkey(ctx, FALSE))
     {
-      // Someone pressing DIT paddle
-      if (!(KEYINP & (1 << DITPIN)))
-      {
-        yackspeed(DOWN, WPMSPEED);
-        // Ignore that control key was pressed
-        volbfr &= ~(CKLATCH);
-      }
+      return;
+    }
 
-      // Someone pressing DAH paddle
-      if (!(KEYINP & (1 << DAHPIN)))
-      {
-        yackspeed(UP, WPMSPEED);
-        volbfr &= ~(CKLATCH);
-      }
+    // Check for a character from the key
+    if ((c = yackiambic(ctx, ON)))
+    {
+      // Add that character to our buffer
+      rambuffer[i++] = c;
+
+      // Reset End of message timer
+      extimer = YACKSECS(DEFTIMEOUT);
     }
 
-    // Trailing edge debounce
-    _delay_ms(50);
+    // End of buffer reached?
+    if (i >= RBSIZE)
+    {
+      yackerror(ctx);
+      i = 0;
+    }
 
-    // In case we had a speed change
-    yacksave();
+    // 10 ms heartbeat
+    yackbeat(ctx);
   }
 
-  // Restore previous state
-  volflags = volbfr;
+  // Extimer has expired. Message has ended
 
-  // Does caller want us to reset latch?
-  if (mode == TRUE)
+  // Was anything received at all?
+  if (i)
   {
-    volflags &= ~(CKLATCH);
-  }
+    // Add a \0 end marker over last space      
+    rambuffer[--i] = 0;
 
-  // In case we had a speed change (Does NOT work if command is here - moved immediately after button release debounce)
-  // yacksave();
+#if 0
+    // Replay the message
+    byte n;
 
-  // Tell caller if we had a ctrl button press
-  return ((volbfr & CKLATCH) != 0);
+    for (n=0;n<i;n++)
+    {
+      //Break to command mode without saving if command key pressed
+      if (yackctrlkey(ctx, TRUE))
+      {
+        return;
+      }
+
+      yackchar(ctx, rambuffer[n]);
+    }
+#endif
+
+    // Store it in EEPROM, up to and including the end marker
+    yackeewrite(yackmsgaddr(msgnr), rambuffer, i + 1);
+  }
+  else
+  {
+    yackerror(ctx);
+  }
 }
 
 
 /*! 
- @brief     Reverse maps a combination of dots and dashes to a character
+ @brief     Reads a digit argument of a macro code
  
- This routine is passed a sequence of dots and dashes in the format we use for morse
- character encoding (see top of this file). It looks up the corresponding character in
- the Flash table and returns it to the caller. 
+ Looks at the next byte of the message. Only a digit is consumed; anything else,
+ including the end marker, is left to the caller.
  
  This is a private function.
  
- @param buffer    A character in YACK CW notation
- @return          The mapped character or /0 if no match was found  
+ @param msg     Start of the message
+ @param n       Read position in the message, advanced past a digit
+ @return        The value of the digit, 0xFF if there is none
  
  */
-static char morsechar(byte buffer)
+static byte yackmacdigit(const char *msg, byte *n)
 {
-  byte i;
+  byte c;
 
-  for (i = 0; i < sizeof(morse); i++)
+  if (*n >= RBSIZE)
   {
-    if (pgm_read_byte(&morse[i]) == buffer)
-    {
-      // First 10 chars are digits
-      if (i < 10)
-      { 
-        return ('0' + i);
-      }
+    return (0xFF);
+  }
 
-      // Then follow letters
-      if (i < 36)
-      {
-        return ('A' + i - 10);
-      }
+  c = yackeeread(msg + *n) - '0';
 
-      // Then special chars
-	    return (pgm_read_byte(&spechar[i - 36]));
-    }
+  if (c > 9)
+  {
+    return (0xFF);
   }
 
-  return '\0';
+  (*n)++;
+
+  return (c);
 }
 
 
@@ -1126,144 +2651,218 @@ static char morsechar(byte buffer)
  back once before it is stored. To erase a message, do not key one.
  
  When called in PLAY mode, the message is just played back. Playback can be aborted using the command
- key.
+ key. The message is streamed from EEPROM character by character and macro codes, introduced
+ by MACESC, are interpreted on the way:
+ 
+   _N   Serial number (see yackserial), padded to SERDIGITS digits
+   _C   Toggles cut numbers (0 sent as T, 9 as N) for the rest of the message
+   _Wnn Sends the rest of the message at nn WPM (MINWPM..MAXWPM, else ignored). The speed
+        is restored at the end
+   _Rn  Plays the message n times in total (once per call, repetitions are word spaced)
+   _Mn  Continues with message n. Up to MAXCHAIN messages are chained per call
+   __   Sends an underline
+ 
+ Unknown codes are skipped. Arguments are only taken from digits, so a code at the end of
+ a message never reads past its end marker.
  
  @param     function    RECORD or PLAY
  @param     msgnr       1 or 2 or 3 or 4
  @return    TRUE if all OK, FALSE if lock prevented message recording
  
  */
-void yackmessage(byte function, byte msgnr)
+void yackmessage(YACKCTX *ctx, byte function, byte msgnr)
 {
-  unsigned char rambuffer[RBSIZE];  // Storage for the message
-  unsigned char c;                  // Work character
-
-  word extimer = 0;  // Detects end of message (10 sec)
-
-  byte i = 0;  // Pointer into RAM buffer
-  byte n;      // Generic counter
+  char digits[5];      // Serial number digits, least significant first
+  unsigned char c;     // Work character
+  byte i;              // Digit counter
+  byte n;              // Read position in the message
+
+  char *msg;           // Start of the message being played
+  byte cut = FALSE;    // Cut numbers active
+  byte serial = FALSE; // Serial number was sent
+  byte rpt = 0;        // Repetitions left (0 = not set by _R yet)
+  byte chain = 0;      // Messages chained so far
+  byte wpm;            // Speed to restore after playback
+  word num;            // Serial number
 
   if (function == RECORD)
   {
-    // 5 Second until message end
-    extimer = YACKSECS(DEFTIMEOUT);
+    yackrecord(ctx, msgnr);
+  }
+
+  if (function == PLAY)
+  {
+    msg = yackmsgaddr(msgnr);
+    wpm = ctx->wpm;
+    n = 0;
 
-    // Continue until we waited 10 seconds
-    while (extimer--)
+    // Stream the message from EEPROM
+    while (TRUE)
     {
-      if (yackctrlkey(FALSE))
+      //Break immediately if command key pressed
+      if (yackctrlkey(ctx, TRUE))
       {
-        return;
+        serial = FALSE;  // Incomplete. Send the same number next time.
+        break;
       }
 
-      // Check for a character from the key
-      if ((c = yackiambic(ON)))
+      c = (n < RBSIZE) ? yackeeread(msg + n++) : 0;
+
+      if (!c)  // End of message
       {
-        // Add that character to our buffer
-        rambuffer[i++] = c;
+        if (rpt > 1)
+        {
+          rpt--;
+          n = 0;
+          yackchar(ctx, ' ');
+          continue;
+        }
 
-        // Reset End of message timer
-        extimer = YACKSECS(DEFTIMEOUT);
+        break;
       }
 
-      // End of buffer reached?
-      if (i >= RBSIZE)
+      if (c != MACESC)
       {
-        yackerror();
-        i = 0;
+        yackmacchar(ctx, c, cut);
+        continue;
       }
 
-      // 10 ms heartbeat
-      yackbeat();
-    }
+      c = (n < RBSIZE) ? yackeeread(msg + n++) : 0;
 
-    // Extimer has expired. Message has ended
+      switch (c)
+      {
+        case MACESC:  // Escaped escape character
+          yackchar(ctx, MACESC);
+          break;
 
-    // Was anything received at all?
-    if (i)
-    {
-      // Add a \0 end marker over last space      
-      rambuffer[--i] = 0;
+        case 'N':  // Serial number
+          num = yackserial(ctx, READ, 0);
 
-#if 0
-      // Replay the message
-      for (n=0;n<i;n++)
-      {
-        //Break to command mode without saving if command key pressed
-        if (yackctrlkey(TRUE))
-        {
-          return;
-        }
+          for (i = 0; num || i < SERDIGITS; i++)
+          {
+            digits[i] = num % 10 + '0';
+            num /= 10;
+          }
 
-        yackchar(rambuffer[n]);
-      }
-#endif
+          while (i)
+          {
+            yackmacchar(ctx, digits[--i], cut);
+          }
 
-      // Store it in EEPROM
-      if (msgnr == 1)
-      {
-        eeprom_write_block(rambuffer, eebuffer1, RBSIZE);
-      }
+          serial = TRUE;
+          break;
 
-      if (msgnr == 2)
-      {
-        eeprom_write_block(rambuffer, eebuffer2, RBSIZE);
-      }
+        case 'C':  // Cut numbers
+          cut = !cut;
+          break;
 
-      if (msgnr == 3)
-      {
-        eeprom_write_block(rambuffer, eebuffer3, RBSIZE);
-      }
+        case 'W':  // Speed, exactly two digits
+          num = yackmacdigit(msg, &n);
+          c = (num <= 9) ? yackmacdigit(msg, &n) : 0xFF;
 
-      if (msgnr == 4)
-      {
-        eeprom_write_block(rambuffer, eebuffer4, RBSIZE);
+          if (c <= 9)
+          {
+            num = num * 10 + c;
+
+            if (num >= MINWPM && num <= MAXWPM)
+            {
+              yacksetwpm(ctx, num);
+            }
+          }
+
+          break;
+
+        case 'R':  // Repeat
+          c = yackmacdigit(msg, &n);
+
+          if (!rpt)  // Only the first pass sets the count
+          {
+            rpt = (c >= 1 && c <= 9) ? c : 1;
+          }
+
+          break;
+
+        case 'M':  // Chain
+          c = yackmacdigit(msg, &n);
+
+          if (c >= 1 && c <= 4 && ++chain < MAXCHAIN)
+          {
+            msg = yackmsgaddr(c);
+            rpt = 0;
+            n = 0;
+          }
+          else
+          {
+            n = RBSIZE;  // End of chain
+          }
+
+          break;
+
+        case 0:  // Escape at end of message
+          n = RBSIZE;
+          break;
       }
     }
-    else
-    {
-      yackerror();
-    }
-  }
 
-  if (function == PLAY)
-  {
-    // Retrieve the message from EEPROM
-    if (msgnr == 1)
+    // Message speed changes are temporary
+    if (ctx->wpm != wpm)
     {
-      eeprom_read_block(rambuffer, eebuffer1, RBSIZE);
+      yacksetwpm(ctx, wpm);
     }
 
-    if (msgnr == 2)
+    // Advance the serial number if it was sent
+    if (serial)
     {
-      eeprom_read_block(rambuffer, eebuffer2, RBSIZE);
+      yackserial(ctx, WRITE, yackserial(ctx, READ, 0) + 1);
     }
+  }
+}
 
-    if (msgnr == 3)
-    {
-      eeprom_read_block(rambuffer, eebuffer3, RBSIZE);
-    }
 
-    if (msgnr == 4)
-    {
-      eeprom_read_block(rambuffer, eebuffer4, RBSIZE);
-    }
+#ifdef TELEMETRY
+/*! 
+ @brief     Returns the telemetry counters
+ 
+ The counters are updated as the keyer runs and cleared by yackinit. Keydown time is
+ counted in beats; put it against yacktime to get the TX duty cycle.
+ 
+ @return        Pointer to the counters (read only)
+ 
+ */
+const struct YACKTLM *yacktelemetry(YACKCTX *ctx)
+{
+  return &ctx->tlm;
+}
 
-    // Replay the message
-    // Read until end of message
-    for (n = 0; (c = rambuffer[n]); n++)
-    {
-      //Break immediately if command key pressed
-      if (yackctrlkey(TRUE))
-      {
-        return;
-      }
 
-      // Play it back
-      yackchar(c);
-    }
+/*! 
+ @brief     Increments a telemetry counter without wrapping around
+ 
+ This is a private function.
+ 
+ @param n   The counter
+ 
+ */
+static void yackcount(word *n)
+{
+  if (*n != 0xFFFF)
+  {
+    (*n)++;
   }
 }
+#endif
+
+
+/*! 
+ @brief     Tells if a character is being keyed
+ 
+ @return        TRUE if elements were keyed that are not decoded yet
+ 
+ */
+byte yackbusy(YACKCTX *ctx)
+{
+  return (ctx->bcntr != 0);
+}
 
 
 /*! 
@@ -1278,16 +2877,13 @@ void yackmessage(byte function, byte msgnr)
  @return        The character if one was recognized, /0 if not
  
  */
-char yackiambic(byte ctrl)
+char yackiambic(YACKCTX *ctx, byte ctrl)
 {
-  static enum FSMSTATE fsms = IDLE;  // FSM state indicator
-  static word timer;                 // A countdown timer
-  static byte lastsymbol;            // The last symbol sent
-  static byte buffer = 0;            // A place to store a sent char
-  static byte bcntr = 0;             // Number of elements sent
-  static byte iwgflag = 0;           // Flag: Are we in interword gap?
-  static byte ultimem = 0;           // Buffer for last keying status
-  char retchar;                      // The character to return to caller
+  char retchar;  // The character to return to caller
+#ifdef TELEMETRY
+  byte latency;  // Beats from paddle closing to the TX edge
+  byte latched;  // Latches present before this beat
+#endif
 
   // This routine is called every YACKBEAT ms. It starts with idle mode where
   // the morse key is polled. Once a contact close is sensed, the TX key is
@@ -1305,29 +2901,61 @@ char yackiambic(byte ctrl)
   // is transmitted in this case.
 
   // Count down
-  if (timer)
+  if (ctx->timer)
   {
-    timer--;
+    ctx->timer--;
   }
 
   // No space detection
   if (ctrl == OFF)
   {
-    iwgflag = 0;
+    ctx->iwgflag = 0;
   }
 
-  switch (fsms)
+  // Background text yields to the paddles. Their element starts in this very beat.
+  if (ctx->qtext && (~KEYINP & ((1 << DITPIN) | (1 << DAHPIN))))
+  {
+    yackinhibit(ctx, OFF);
+  }
+
+  // Straight key or bug: the pin change ISR keys, the beat only times the elements
+  // for the decoder
+  if ((ctx->xflags & STRAIGHT) && !ctx->qtext)
+  {
+    yackpass(ctx);
+  }
+
+  switch (ctx->fsms)
   {
     case IDLE:
-      keylatch();
+#ifdef TELEMETRY
+      latched = ctx->volflags & (DITLATCH | DAHLATCH);
+#endif
+
+      keylatch(ctx, ~KEYINP);
 
 #ifdef POWERSAVE
       // OK to go to sleep when here.
-      yackpower(TRUE);
+      yackpower(ctx, TRUE);
+#endif
+
+#ifdef TELEMETRY
+      // Stamp the beat in which a contact is first seen closed in idle, also while
+      // autospace holds the element back. Latches made during an element or gap
+      // are keyed as soon as that is over and are not timed.
+      if (!(ctx->volflags & (DITLATCH | DAHLATCH)))
+      {
+        ctx->tlm.timed = 0;
+      }
+      else if (!latched)
+      {
+        ctx->tlm.latchstamp = ticks;
+        ctx->tlm.timed = 1;
+      }
 #endif
 
       // Handle latching logic for various keyer modes
-      switch (yackflags & MODE)
+      switch (ctx->yackflags & MODE)
       {
         case IAMBICA:
         case IAMBICB:
@@ -1335,8 +2963,8 @@ char yackiambic(byte ctrl)
           // dots and dashes are alternating. To do that, whe delete
           // any latched paddle of the same kind that we just sent.
           // However, we only do this ONCE
-          volflags &= ~lastsymbol;
-          lastsymbol = 0;
+          ctx->volflags &= ~ctx->lastsymbol;
+          ctx->lastsymbol = 0;
 
           break;
 
@@ -1345,54 +2973,70 @@ char yackiambic(byte ctrl)
           // In case the keyer is squeezed right out of idle mode, we just send a DAH
 
           // Squeezed?
-          if ((volflags & SQUEEZED) == SQUEEZED)
+          if ((ctx->volflags & SQUEEZED) == SQUEEZED)
           {
-            if (ultimem)
+            if (ctx->ultimem)
             {
               // Opposite symbol from last one
-              volflags &= ~ultimem;
+              ctx->volflags &= ~ctx->ultimem;
             }
             else
             {
               // Reset the DIT latch
-              volflags &= ~DITLATCH;
+              ctx->volflags &= ~DITLATCH;
             }
           }
           // Remember the last single key
           else
           {
-            ultimem = volflags & SQUEEZED;
+            ctx->ultimem = ctx->volflags & SQUEEZED;
           }
 
           break;
 
         case DAHPRIO:
           // If both paddles pressed, DAH is given priority
-          if ((volflags & SQUEEZED) == SQUEEZED)
+          if ((ctx->volflags & SQUEEZED) == SQUEEZED)
           {
             // Reset the DIT latch
-            volflags &= ~DITLATCH;
+            ctx->volflags &= ~DITLATCH;
           }
 
           break;
       }
 
+      // Background text plays its next element once the gap is over
+      if (ctx->qtext)
+      {
+        if (ctx->timer == 0)
+        {
+          yacknext(ctx);
+        }
+
+        break;
+      }
+
       // The following handles the inter-character gap. When there are
       // three (default) dot lengths of space after an element, the
       // character is complete and can be returned to caller
 
       // Have we idled for 3 dots and is there something to decode?
-      if (timer == 0 && bcntr != 0)
+      if (ctx->timer == 0 && ctx->bcntr != 0)
       {
-        buffer = buffer << 1;                // Make space for the termination bit
-        buffer |= 1;                         // The 1 on the right signals end
-        buffer = buffer << (7 - bcntr);      // Shift to left justify
-        retchar = morsechar(buffer);         // Attempt decoding
-        buffer = bcntr = 0;                  // Clear buffer
-        timer = (IWGLEN - ICGLEN) * wpmcnt;  // If 4 further dots of gap, this might be a Word gap.
+        ctx->buffer = ctx->buffer << 1;                 // Make space for the termination bit
+        ctx->buffer |= 1;                               // The 1 on the right signals end
+        ctx->buffer = ctx->buffer << (7 - ctx->bcntr);  // Shift to left justify
+        retchar = morsechar(ctx->buffer);               // Attempt decoding
+        ctx->buffer = ctx->bcntr = 0;                   // Clear buffer
+
+#ifdef TELEMETRY
+        yackcount(retchar ? &ctx->tlm.decoded : &ctx->tlm.undecoded);
+#endif
+
+        ctx->timer = (IWGLEN - ICGLEN) * ctx->wpmcnt;   // If 4 further dots of gap, this might be a Word gap.
 
         // Signal we are waiting for IWG
-        iwgflag = 1;
+        ctx->iwgflag = 1;
 
         // and return decoded char
         return (retchar);
@@ -1402,86 +3046,183 @@ char yackiambic(byte ctrl)
       // waited for, if 4 more follow, interpret this as a word end
 
       // Have we idled for 4+3 = 7 dots?
-      if (timer == 0 && iwgflag)
+      if (ctx->timer == 0 && ctx->iwgflag)
       {
         // Clear Interword Gap flag
-        iwgflag = 0;
+        ctx->iwgflag = 0;
 
         // And return a space
         return (' ');
       }
 
+      // Straight key: the element started when the key went down. It counts as a dah
+      // when held for 2 dots or longer.
+      if ((ctx->xflags & STRAIGHT) && !ctx->qtext)
+      {
+        if (ctx->keyed)
+        {
+          ctx->iwgflag = 0;
+
+          if (ctx->bcntr < MAXELEMENTS)
+          {
+            ctx->bcntr++;
+            ctx->buffer = ctx->buffer << 1;
+          }
+
+          ctx->timer = 2 * ctx->wpmcnt;
+          ctx->fsms = KEYED;
+        }
+
+        break;
+      }
+
       // Now evaluate the latch and determine what to send next
 
       // Anything in the latch?
-      if (volflags & (DITLATCH | DAHLATCH))
+      if (ctx->volflags & (DITLATCH | DAHLATCH))
       {
-        iwgflag = 0;           // No interword gap if dit or dah
-        bcntr++;               // Count that we will send something now
-        buffer = buffer << 1;  // Make space for the new character
+        // Autospace: a character has just been decoded. Hold the next element back
+        // until the gap has grown to a full inter-character gap.
+        if ((ctx->yackflags & AUTOSPACE) && !ctx->bcntr && ctx->timer > ctx->elements.aspace)
+        {
+          break;
+        }
+
+        ctx->iwgflag = 0;                // No interword gap if dit or dah
+        ctx->bcntr++;                    // Count that we will send something now
+        ctx->buffer = ctx->buffer << 1;  // Make space for the new character
 
         // Is it a dit?
-        if (volflags & DITLATCH)
+        if (ctx->volflags & DITLATCH)
         {
-          timer = DITLEN * wpmcnt;  // Duration = one dot time
-          lastsymbol = DITLATCH;    // Remember what we sent
+          ctx->timer = ctx->elements.dit;  // Duration = one dot time
+          ctx->lastsymbol = DITLATCH;  // Remember what we sent
         }
         // must be a DAH then..
         else
         {
-          timer = DAHLEN * wpmcnt;  // Duration = one dash time
-          lastsymbol = DAHLATCH;    // Remember
-          buffer |= 1;              // set LSB to remember dash
+          ctx->timer = ctx->elements.dah;  // Duration = one dash time
+          ctx->lastsymbol = DAHLATCH;  // Remember
+          ctx->buffer |= 1;            // set LSB to remember dash
         }
 
         // Switch on the side tone and TX
-        key(DOWN);
+        key(ctx, DOWN);
+
+#if defined(POWERSAVE) && defined(TXOC1A)
+        // The element that woke us up does not wait for the next beat. Its key-up edge
+        // still comes with a compare match, one beat after key(), so end it one beat
+        // early to keep the TX element and the following gap at their exact length.
+        if (woke)
+        {
+          GTCCR |= (1 << FOC1A);
+
+          if (ctx->timer > 1)
+          {
+            ctx->timer--;
+          }
+        }
+#endif
+
+#ifdef TELEMETRY
+        // The PTT lead has passed in key() already. An OC1A edge that is not forced
+        // still waits for the next compare match.
+        if (ctx->tlm.timed)
+        {
+          latency = (byte)ticks - ctx->tlm.latchstamp;
+
+#ifdef TXOC1A
+#ifdef POWERSAVE
+          if ((ctx->volflags & TXKEY) && !woke)
+#else
+          if (ctx->volflags & TXKEY)
+#endif
+          {
+            latency++;
+          }
+#endif
+
+          yackcount(&ctx->tlm.latency[(latency < TLMBINS) ? latency : TLMBINS - 1]);
+          ctx->tlm.timed = 0;
+        }
+#endif
 
         // Reset both latches
-        volflags &= ~(DITLATCH | DAHLATCH);
+        ctx->volflags &= ~(DITLATCH | DAHLATCH);
 
         // Change FSM state
-        fsms = KEYED;
+        ctx->fsms = KEYED;
       }
 
       break;
 
     case KEYED:
 #ifdef POWERSAVE
-      yackpower(FALSE);  // can not go to sleep when keyed
+      yackpower(ctx, FALSE);  // can not go to sleep when keyed
 #endif
 
-      // If we are in IAMBIC B mode
-      if ((yackflags & MODE) == IAMBICB)
+      // Straight key released? The character is complete after 2 dots of gap, as
+      // with the paddles.
+      if ((ctx->xflags & STRAIGHT) && !ctx->qtext)
+      {
+        if (!ctx->keyed)
+        {
+          if (!ctx->timer)
+          {
+            ctx->buffer |= 1;
+          }
+
+          ctx->timer = (ICGLEN - 1) * ctx->wpmcnt;
+          ctx->fsms = IDLE;
+        }
+
+        break;
+      }
+
+      // Latch once the element has reached the latch window of the mode
+      // (IAMBIC B latches during the whole element by default, A not at all)
+      if (ctx->timer < ((ctx->lastsymbol == DITLATCH) ? ctx->elements.ditlatch : ctx->elements.dahlatch))
       {
-        // then latch here already
-        keylatch();
+        keylatch(ctx, ~KEYINP);
       }
 
       // Done with sounding our element?
-      if (timer == 0)
+      if (ctx->timer == 0)
       {
-        key(UP);                  // Then cancel the side tone
-        timer = IEGLEN * wpmcnt;  // One dot time for the gap
-        fsms = IEG;               // Change FSM state
+        key(ctx, UP);                    // Then cancel the side tone
+        ctx->timer = ctx->elements.ieg;  // One dot time for the gap
+        ctx->fsms = IEG;                 // Change FSM state
       }
 
       break;
 
     case IEG:
       // Latch any paddle movements (both A and B)
-      keylatch();
+      keylatch(ctx, ~KEYINP);
 
       // End of gap reached?
-      if (timer == 0)
+      if (ctx->timer == 0)
       {
         // Change FSM state
-        fsms = IDLE;
+        ctx->fsms = IDLE;
 
         // The following timer determines what the IDLE state
         // accepts as character. Anything longer than 2 dots as gap will be
         // accepted for a character end.
-        timer = (ICGLEN - IEGLEN - 1) * wpmcnt;
+        ctx->timer = (ICGLEN - IEGLEN - 1) * ctx->wpmcnt;
+
+        // Background text: next element right away or wait out the character gap
+        if (ctx->qtext)
+        {
+          if (ctx->qcode != 0x80)
+          {
+            yacknext(ctx);
+          }
+          else
+          {
+            ctx->timer = (ICGLEN - IEGLEN) * ctx->wpmcnt + ctx->farnsicg;
+          }
+        }
       }
 
       break;
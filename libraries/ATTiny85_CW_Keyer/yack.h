@@ -44,11 +44,33 @@
 #define DAHPIN       4
 #define DAHPULLUP    0
 
+// Optional PTT output for transmitters or amplifiers that need to be switched to TX before RF
+// is keyed. It goes high PTTLEAD ms before the first element and drops PTTHANG ms after the
+// last one. There is no spare pin in the default configuration; PB5 can be used when RESET
+// is disabled.
+//#define PTTPIN       5      // Uncomment to enable the PTT output
+#define PTTDDR       DDRB
+#define PTTPORT      PORTB
+#define PTTLEAD      15       // Lead time in ms (multiple of YACKBEAT)
+#define PTTHANG      250      // Hang time in ms
+
+// Optional serial output of the decoded text (8N1, idle high, one bit per beat = 200 baud).
+// Like PTT it needs a spare pin such as PB5 with RESET disabled. The line needs a level
+// shifter or USB serial adapter at logic level towards the PC.
+//#define SERIALPIN    5      // Uncomment to enable the serial output
+#define SERDDR       DDRB
+#define SERPORT      PORTB
+#define SERBUF       16       // Characters buffered (power of 2)
+
+// EEPROM writes are queued and carried out in the background, one byte per EEPROM ready
+// interrupt. Each entry costs 3 bytes of RAM. Longer writes wait for room in the queue.
+#define EEQSIZE      16       // Bytes queued (power of 2)
+
 // The following defines the meaning of status bits in the yackflags and volflags
 // global variables
 
 // Definition of the yackflags variable. These settings get stored in EEPROM when changed.
-#define NOTUSED1     0b00000001  // Available
+#define AUTOSPACE    0b00000001  // Set if the keyer enforces full character gaps
 #define CONFLOCK     0b00000010  // Configuration locked down
 #define MODE         0b00001100  // 2 bits to define keyer mode (see next section)
 #define SIDETONE     0b00010000  // Set if the chip must produce a sidetone
@@ -70,6 +92,9 @@
 #define CKLATCH      0b00001000  // Set if the command key was pressed at some point
 #define VSCOPY       0b00110000  // Copies of Sidetone and TX flags from yackflags
 
+// Definition of the xflags variable. Extended settings, stored in EEPROM like yackflags.
+#define STRAIGHT     0b00000001  // Set if a straight key or bug is passed through
+
 // The following defines timing constants. In the default version the keyer is set to operate in
 // 10ms heartbeat intervals. If a higher resolution is required, this can be changed to a faster
 // beat
@@ -85,23 +110,55 @@
 //              ((1 << PCINT3) | (1 << PCINT4) | (1 << PCINT2))
 #define PWRWAKE ((1 << DITPIN) | (1 << DAHPIN) | (1 << BTNPIN))  // Dit, Dah or Command wakes us up..
 
+// Speed potentiometer. Uncomment SPEEDPOT to read the speed from a pot (wiper to an ADC input,
+// ends to VCC and GND). There is no spare pin in the default configuration; ADC0 on PB5 can be
+// used when RESET is disabled (or kept in the upper voltage range above the reset threshold).
+//#define SPEEDPOT           // Uncomment to enable the speed pot
+#define POTMUX          0  // ADC channel of the pot wiper (0 = ADC0 on PB5)
+#define POTDIDR    ADC0D  // Digital input buffer to disable for that channel
+#define POTIIR          3  // IIR filter: each sample contributes 1/2^POTIIR
+#define POTHYST        64  // Hysteresis in 1/256 WPM steps
+
+// Telemetry. Usage counters in RAM that are cleared on power up (see yacktelemetry)
+#define TELEMETRY          // Comment this line if no telemetry required
+#define TLMBINS         8  // Latency histogram bins of one beat each. The last one collects the rest.
+
 // These values limit the speed that the keyer can be set to
 #define MAXWPM         50
 #define MINWPM          5
 #define DEFWPM         15
 
-// Farnsworth parameters
+// Farnsworth parameters (the Farnsworth setting is an effective WPM between MINWPM and wpm)
 #define FARNSWORTH      1
 #define WPMSPEED        0
-#define MAXFARN       255
+#define WEIGHTING       2
+#define DAHRATIO        3
+#define TXCOMP          4
+#define LATCHWIN        5
+
+// Element timing parameters
+#define DEFWEIGHT      16  // Dit keydown in 1/32 of a dit period (16 = 50%, standard)
+#define MINWEIGHT       8  // 25%
+#define MAXWEIGHT      24  // 75%
+#define DEFRATIO       24  // Dah length in 1/8 dits (24 = 3:1)
+#define MINRATIO       20  // 2.5:1
+#define MAXRATIO       36  // 4.5:1
+#define DEFCOMP         0  // TX keying compensation in beats (YACKBEAT ms each) added to every keydown
+#define MAXCOMP        10  // 50 ms
+
+// Paddle latch window for IAMBIC A and B: percentage of an element that must have elapsed
+// before paddles are latched for the next element. 100 means latching starts in the element gap.
+#define DEFLATCHA     100  // IAMBIC A latches in the gap only
+#define DEFLATCHB       0  // IAMBIC B latches during the whole element
+#define LATCHSTEP      10  // Adjustment step in percent
 
-#define WPMCALC(n) ((1200 / YACKBEAT) / n)  // Calculates number of beats in a dot
 
 #define DITLEN          1   // Length of a dot
 #define DAHLEN          3   // Length of a dash
 #define IEGLEN          1   // Length of inter-element gap
 #define ICGLEN          3   // Length of inter-character gap
 #define IWGLEN          7   // Length of inter-word gap
+#define MAXELEMENTS     7   // Most elements in one character
 
 // Duration of various internal timings in seconds
 #define TUNEDURATION   20  // Duration of tuning keydown (in seconds)
@@ -125,9 +182,21 @@
 #define MINCTC CTCVAL(MINFREQ)
 #define DEFCTC CTCVAL(DEFFREQ)
 
+// Oscillator calibration reference tone. F_CPU / (2 * PRESCALE) must be divisible by it
+// so that the tone is exact (625 Hz at 1MHz).
+#define CALFREQ       625
+#define CALCTC CTCVAL(CALFREQ)
+#define CALREPEAT      40  // Beats between OSCCAL steps while a paddle is held
+
 // The following are various definitions in use throughout the program
 #define RBSIZE        100  // Size of each of the four EEPROM buffers
 
+// Macro codes in messages. The escape character is followed by one code letter:
+// _N serial number, _C cut numbers on/off, _Wnn speed, _Rn repeat, _Mn chain, __ an underline
+#define MACESC        '_'  // Escape character (keyed as ..--.-)
+#define SERDIGITS       3  // Serial numbers are padded with leading zeros to this length
+#define MAXCHAIN        4  // Most chained messages played per call
+
 #define MAGPAT       0xA5  // If this number is found in EEPROM, content assumed valid
 
 #define DIT             1
@@ -155,31 +224,269 @@
 typedef uint8_t byte;
 typedef uint16_t word;
 
+// Enumerations
+enum FSMSTATE
+{
+  IDLE,   //!< Not keyed, waiting for paddle
+  KEYED,  //!< Keyed, waiting for duration of current element
+  IEG     //!< In Inter-Element-Gap
+};
+
+#ifdef TELEMETRY
+// Telemetry counters. Counts saturate instead of wrapping around.
+struct YACKTLM
+{
+  word sent;              // Characters sent by yackchar
+  word decoded;           // Characters decoded from the paddles
+  word undecoded;         // Paddle code words without a matching character
+  uint32_t keydown;       // Beats the key was down (TX duty cycle against yacktime)
+  word latency[TLMBINS];  // Paddle-to-TX-edge latency in beats
+  byte latchstamp;        // Beat (low byte) at which a paddle was first seen closed
+  byte timed;             // Set if latchstamp belongs to the latch keyed next
+  word keystamp;          // Beat (low word) at which the key went down
+};
+#endif
+
+// Stored configuration. The active configuration is kept in EEPROM as two copies and a selector
+// byte: a save writes the unused copy and then switches the selector, so an interrupted save
+// leaves the previous configuration in place. Profiles use the same layout.
+#define PROFILES        3  // Number of configuration profiles
+
+struct YACKCFG
+{
+  byte yackflags;         // Module flags
+  word ctcvalue;          // Pitch
+  byte wpm;               // Speed
+  byte farnsworth;        // Farnsworth effective WPM
+  byte weight;            // Weighting
+  byte dahratio;          // Dah ratio
+  byte txcomp;            // TX compensation
+  byte latchwin[2];       // Latch windows
+  byte sum;               // Checksum over the above
+};
+
+// Keyer context. Holds the complete state of one keyer. The application allocates it
+// (usually once, statically) and passes it to every library call. It is initialized by
+// yackinit and should be treated as opaque by the application.
+struct YACKCTX
+{
+  byte yackflags;         // Permanent (stored) status of module flags
+  byte volflags;          // Temporary working flags (volatile)
+  byte xflags;            // Permanent (stored) extended flags
+  volatile byte keyed;    // Key is down (also set by the pin change ISR, see STRAIGHT)
+  word ctcvalue;          // Pitch
+  word wpmcnt;            // Speed
+  byte wpm;               // Real wpm
+  byte farnsworth;        // Farnsworth effective WPM (0 = off)
+  word farnsicg;          // Beats added to each inter-character gap
+  word farnsiwg;          // Beats added to each inter-word gap
+  byte weight;            // Dit keydown in 1/32 of a dit period
+  byte dahratio;          // Dah length in 1/8 dits
+  byte txcomp;            // TX keying compensation in beats
+  byte latchwin[2];       // Latch window in percent for IAMBIC A [0] and B [1]
+
+  // Element duration table in beats. Recomputed whenever speed, weighting,
+  // dah ratio or compensation change
+  struct
+  {
+    word dit;             // Keydown of a dit
+    word dah;             // Keydown of a dah
+    word ieg;             // Gap after either element
+    word ditlatch;        // Paddles are latched while less than this is left of a dit
+    word dahlatch;        // .. or of a dah
+    word aspace;          // Autospace holds elements back while the IDLE timer is above this
+  } elements;
+
+  // IAMBIC keyer state machine
+  enum FSMSTATE fsms;     // FSM state indicator
+  word timer;             // A countdown timer
+  byte lastsymbol;        // The last symbol sent
+  byte buffer;            // A place to store a sent char
+  byte bcntr;             // Number of elements sent
+  byte iwgflag;           // Flag: Are we in interword gap?
+  byte ultimem;           // Buffer for last keying status
+
+  // Background text (see yackqueue)
+  const byte *qtext;      // Next character in Flash (NULL = none)
+  byte qcode;             // Elements left of the current character (0 = gap owed)
+
+#ifdef SPEEDPOT
+  word potfilt;           // Filtered pot reading (2^POTIIR times the 8 bit ADC value)
+  byte potwpm;            // Speed last set by the pot
+#endif
+#ifdef POWERSAVE
+  uint32_t shdntimer;     // Beats idle since last activity
+#endif
+#ifdef PTTPIN
+  word ptttimer;          // Beats of PTT hang time left (0 = PTT off)
+#endif
+#ifdef TELEMETRY
+  struct YACKTLM tlm;     // Usage counters
+#endif
+};
+
+// Morse code table, shared by the Flash table in yack.cpp and the compile time encoder below.
+// Encoding: Each byte is read from the left. 0 stands for a dot, 1
+// stands for a dash. After each played element the content is shifted
+// left. Playback stops when the leftmost bit contains a "1" and the rest
+// of the bits are all zero.
+//
+// Example: A = .-
+// Encoding: 01100000
+//           .-
+//             | This is the stop marker (1 with all trailing zeros)
+//
+// Digits come first, then letters, then the special characters listed in SPECHARS.
+#define MORSECODES \
+  0b11111100,  /* 0 */                                                        \
+  0b01111100,  /* 1 */                                                        \
+  0b00111100,  /* 2 */                                                        \
+  0b00011100,  /* 3 */                                                        \
+  0b00001100,  /* 4 */                                                        \
+  0b00000100,  /* 5 */                                                        \
+  0b10000100,  /* 6 */                                                        \
+  0b11000100,  /* 7 */                                                        \
+  0b11100100,  /* 8 */                                                        \
+  0b11110100,  /* 9 */                                                        \
+  0b01100000,  /* A */                                                        \
+  0b10001000,  /* B */                                                        \
+  0b10101000,  /* C */                                                        \
+  0b10010000,  /* D */                                                        \
+  0b01000000,  /* E */                                                        \
+  0b00101000,  /* F */                                                        \
+  0b11010000,  /* G */                                                        \
+  0b00001000,  /* H */                                                        \
+  0b00100000,  /* I */                                                        \
+  0b01111000,  /* J */                                                        \
+  0b10110000,  /* K */                                                        \
+  0b01001000,  /* L */                                                        \
+  0b11100000,  /* M */                                                        \
+  0b10100000,  /* N */                                                        \
+  0b11110000,  /* O */                                                        \
+  0b01101000,  /* P */                                                        \
+  0b11011000,  /* Q */                                                        \
+  0b01010000,  /* R */                                                        \
+  0b00010000,  /* S */                                                        \
+  0b11000000,  /* T */                                                        \
+  0b00110000,  /* U */                                                        \
+  0b00011000,  /* V */                                                        \
+  0b01110000,  /* W */                                                        \
+  0b10011000,  /* X */                                                        \
+  0b10111000,  /* Y */                                                        \
+  0b11001000,  /* Z */                                                        \
+  0b00110010,  /* ? */                                                        \
+  0b01010110,  /* . */                                                        \
+  0b10010100,  /* / */                                                        \
+  0b11101000,  /* ! (American Morse version, commonly used in ham circles) */ \
+  0b11001110,  /* , */                                                        \
+  0b11100010,  /* : */                                                        \
+  0b10101010,  /* ; */                                                        \
+  0b01001010,  /* " */                                                        \
+  0b00010011,  /* $ */                                                        \
+  0b01111010,  /* ' (Apostrophe) */                                           \
+  0b10110100,  /* ( or [ (also prosign KN) */                                 \
+  0b10110110,  /* ) or ] */                                                   \
+  0b10000110,  /* - (Hyphen or single dash) */                                \
+  0b01101010,  /* @ */                                                        \
+  0b00110110,  /* _ (Underline) */                                            \
+  0b01010010,  /* Paragaraph break symbol */                                  \
+  0b10001100,  /* = and BT */                                                 \
+  0b00010110,  /* SK */                                                       \
+  0b01010100,  /* + and AR */                                                 \
+  0b10001011,  /* BK */                                                       \
+  0b01000100,  /* AS */                                                       \
+  0b10101100,  /* KA (also ! in alternate Continental Morse) */               \
+  0b00010100,  /* VE */                                                       \
+  0b01011000   /* AA */
+
+// The special characters at the end of the above table can not be decoded
+// without a small table to define their content. # stands for SK, $ for AR
+// To add new characters, add them in the code table above at the end and here.
+#define SPECHARS "?./!,:;~$^()-@_|=#+*%&<>"
+
+// Compile time Morse encoding of fixed texts. YACKCW(name, "TEXT") defines name as a text in
+// Flash that is already encoded: one MORSECODES byte per character, 0x80 for a word space and
+// 0 at the end. yackcode plays it without any table lookup. A character without a Morse code
+// stops compilation (yacknocode is deliberately not constexpr and never defined).
+constexpr byte yackcodes[] = {MORSECODES};
+constexpr char yackspecs[] = SPECHARS;
+
+byte yacknocode(char c);
+
+constexpr byte yackspecial(char c, byte i)
+{
+  return yackspecs[i] ? ((yackspecs[i] == c) ? yackcodes[i + 36] : yackspecial(c, i + 1)) : yacknocode(c);
+}
+
+constexpr byte yackencode(char c)
+{
+  return (c == ' ') ? 0x80 :
+         (c >= '0' && c <= '9') ? yackcodes[c - '0'] :
+         (c >= 'A' && c <= 'Z') ? yackcodes[c - 'A' + 10] :
+         (c >= 'a' && c <= 'z') ? yackcodes[c - 'a' + 10] :
+         yackspecial(c, 0);
+}
+
+// Index sequence 0..N-1 to walk the text (C++11 has no std::index_sequence)
+template <byte... I> struct yackseq {};
+template <byte N, byte... I> struct yackmkseq : yackmkseq<N - 1, N - 1, I...> {};
+template <byte... I> struct yackmkseq<0, I...> { typedef yackseq<I...> type; };
+
+template <class T, class S = typename yackmkseq<sizeof(T::text) - 1>::type> struct yackcw;
+
+template <class T, byte... I> struct yackcw<T, yackseq<I...> >
+{
+  static constexpr byte code[sizeof...(I) + 1] PROGMEM = {yackencode(T::text[I])..., 0};
+};
+
+template <class T, byte... I> constexpr byte yackcw<T, yackseq<I...> >::code[sizeof...(I) + 1];
+
+#define YACKCW(name, str)                                           \
+  struct yackcwtext_##name { static constexpr char text[] = str; }; \
+  constexpr const byte *name = yackcw<yackcwtext_##name>::code
+
 // Forward declarations of public functions
-void yackinit(byte flags);
-void yackchar(char c);
-void yackstring(const char* p);
-char yackiambic(byte ctrl);
-void yackpitch(uint8_t dir);
-void yacktune(void);
-void yackmode(uint8_t mode);
-void yackinhibit(uint8_t mode);
-void yackerror(void);
-void yacktoggle(byte flag);
-byte yackflag(byte flag);
-void yackbeat(void);
-void yackmessage(byte function, byte msgnr);
-void yacksave(void);
-byte yackctrlkey(byte mode);
-void yackreset(byte flags);
-word yackuser(byte func, byte nr, word content);
-void yacknumber(word n);
-word yackwpm(void);
-void yackplay(byte i);
-void yackdelay(byte n);
-void yackfarns(void);
-void yackspeed(byte dir, byte mode);
+void yackinit(YACKCTX *ctx, byte flags);
+void yackchar(YACKCTX *ctx, char c);
+void yackstring(YACKCTX *ctx, const char* p);
+void yackcode(YACKCTX *ctx, const byte *p);
+void yackqueue(YACKCTX *ctx, const byte *p);
+char yackiambic(YACKCTX *ctx, byte ctrl);
+void yackpitch(YACKCTX *ctx, uint8_t dir);
+void yacktune(YACKCTX *ctx);
+void yackmode(YACKCTX *ctx, uint8_t mode);
+void yackinhibit(YACKCTX *ctx, uint8_t mode);
+void yackerror(YACKCTX *ctx);
+void yacktoggle(YACKCTX *ctx, byte flag);
+void yackxtoggle(YACKCTX *ctx, byte flag);
+byte yackflag(YACKCTX *ctx, byte flag);
+void yackbeat(YACKCTX *ctx);
+void yackmessage(YACKCTX *ctx, byte function, byte msgnr);
+void yacksave(YACKCTX *ctx);
+byte yackctrlkey(YACKCTX *ctx, byte mode);
+void yackreset(YACKCTX *ctx, byte flags);
+word yackuser(YACKCTX *ctx, byte func, byte nr, word content);
+void yacknumber(YACKCTX *ctx, word n);
+word yackwpm(YACKCTX *ctx);
+void yackplay(YACKCTX *ctx, byte i);
+void yackdelay(YACKCTX *ctx, byte n);
+void yackfarns(YACKCTX *ctx);
+void yackspeed(YACKCTX *ctx, byte dir, byte mode);
+void yacksetwpm(YACKCTX *ctx, byte n);
+byte yackbusy(YACKCTX *ctx);
+uint32_t yacktime(YACKCTX *ctx);
+void yackcalibrate(YACKCTX *ctx);
+word yackserial(YACKCTX *ctx, byte func, word n);
+byte yackprofile(YACKCTX *ctx, byte func, byte nr);
+
+#ifdef TELEMETRY
+const struct YACKTLM *yacktelemetry(YACKCTX *ctx);
+#endif
+
+#ifdef SERIALPIN
+void yacklog(YACKCTX *ctx, char c);
+#endif
 
 #ifdef POWERSAVE
-void yackpower(byte n);
+void yackpower(YACKCTX *ctx, byte n);
 #endif